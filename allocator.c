@@ -9,23 +9,41 @@
  * (b) status of allocation (free or allocated)                                                                                               
  * (c) index which points to the free list in the segregated free lists array the block belongs to.                                           
  *                                                                                                                                            
+ * When built for 16-byte alignment (-DALIGN16) the header stays 8 bytes: every block size is a multiple of 16 and
+ * every header sits at an address that is 8 mod 16, so payloads land on 16-byte boundaries. Where the top chunk would
+ * start on a 16-byte boundary, an 8-byte padding header (payload 0, marked allocated) is placed first.
+ *
  * Free blocks are stored in one of many size segregated linked lists. There are 28 linked list (0 to 27)                                     
  * each list contains blocks with sizes between 2^n to 2^(n+1)-1, the last linked list is reserved for myrealloc.                             
  * we start from size class 2^4 - (2^5)-1, since the minimum block size can be allocated is 16 bytes (including header).                      
  *                                                                                                                                            
+ * The tail of the heap is the top chunk: a contiguous region between top_ptr and top_end that is not on any free list.
+ *                                                                                                                                            
  * To allocate a block, we determine the requested size class and do a first-fit search of the appropriate free list for                      
  * a block that fits. if we find one, then we split it and based on the number of HITS for this size class we either leave                                                                                                
  * the remaining fragment in the same free list or insert it into the appropriate free list that match its new size. If we can't              
  * find a block that fits, then we search the free list for the next larger size class (Unless the number of HITS for                         
  * this size class exceedes the HIT_SENSOR then we break out of the loop and ask the operating system for more memory).                       
- * This is repeated untill a block is found. If none was found in all free lists, we request additional heap memory from the Operating System.
- * Allocate the block and place the remainder in the appropriate size class. To free a block we read its index (or size) and place            
- * it on the matching free list.                                                                                                              
+ * This is repeated untill a block is found. If none was found in all free lists, the block is carved from the top chunk by bumping
+ * top_ptr. When the top chunk is too small it is refilled with additional heap memory from the Operating System, which extends it in
+ * place since the segment grows contiguously. To free a block we read its index (or size) and place it on the matching free list,
+ * unless the block sits right below top_ptr, in which case it is given back to the top chunk.                                              
  *                                                                                                                                          
- * Reallocation is handeled seperately, it has its own free list in index 27 (last one) in the segregated free list array.                    
+ * Reallocation is handeled seperately, it has its own free list in index 28 in the segregated free list array.
  * If reallocation is requested, first we check if the originally allocated size can still provide the requested new size                     
  * if so we just return the same pointer if not we request memory from the OS and move everything to the realloc free list                    
- * in index 27 and process everthing in there for any future reallocing. 
+ * in index 28 and process everthing in there for any future reallocing. 
+ *
+ * Very large blocks (block size above EXT_THRESHOLD, about 4 GB) do not fit the 32-bit payloadsz of the header.
+ * They get an extended header: an extra 8-byte word holding the full 64-bit payload size, placed right before
+ * the normal header whose payloadsz is set to the EXT_PAYLOADSZ marker. Such blocks always start on a page
+ * boundary, are never split and are kept on their own free list in index 29 (last one).
+ *
+ * Allocations hinted short-lived (mymalloc_hint) are kept apart from the free lists, in regions (so are permanent ones
+ * that find no hole in the free lists to fill, and tagged ones, see mymalloc_tagged):
+ * REGION_SIZE-aligned heap blocks, one current region per lifetime or tag, that blocks are carved from by bumping a
+ * pointer. A region counts its live blocks. Their header index is REGION_INDEX, so myfree sends them back to
+ * their region, and a region whose blocks have all been freed is rewound (if it is still current) or kept as a spare.
  */                                                                     
  
                                                                             
@@ -35,15 +53,24 @@
 #include "segment.h"                                                           
 #include "limits.h"                                                            
 #include <stdio.h>                                                             
+#include <stdint.h>                                                            
+#include <pthread.h>
                                                                                
-// Heap blocks are required to be aligned to 8-byte boundary                   
-#define ALIGNMENT 8                                                            
+// Heap blocks are required to be aligned to HEAP_ALIGNMENT (8, or 16 when built with -DALIGN16)
+#define ALIGNMENT HEAP_ALIGNMENT
 #define MIN_BLK_SZ 16
 #define EXP 4            //The exponent of the minimum block size can be allocated (base 2) 2^4 = 16 = MIN_BLK_SZ
 #define TRUE 1           //This is easier to read and less complex than enum (personal preference)
 #define FALSE 0
-#define REALLOC_INDEX 27 // The index (in segregated free lists array) of the free list dedicated for reallocation 
-#define SZ_CLASSES  28  // Number of segregated size classes (free lists)
+#define REALLOC_INDEX 28 // The index (in segregated free lists array) of the free list dedicated for reallocation 
+#define EXT_INDEX 29     // The index of the free list dedicated for blocks with an extended header
+#define SZ_CLASSES  30  // Number of segregated size classes (free lists)
+#define REGION_INDEX SZ_CLASSES  // Index past the free lists, marks a block carved from a lifetime region
+
+#define EXT_THRESHOLD ((1UL << 32) - PAGE_SIZE)  // Blocks bigger than this (including header) get an extended header
+#define EXT_PAYLOADSZ UINT_MAX                   // payloadsz value marking a header as extended, real size is in the word before it
+#define EXT_HDR_SZ (sizeof(size_t) + sizeof(headerT))  // Extended size word + normal header
+#define MAX_REQUEST (1UL << 46)                  // Larger requests cannot be served by any segment reservation
 
 
 
@@ -56,6 +83,32 @@
 
 #define HIT_SENSOR 150000   // This can be increased and decreased to notice its effect on Utilization and Throughput, less = more sensitive
 
+/* In pool mode (myinit_pool) the heap is a fixed, pre-faulted pool and no request ever calls extend_heap_segment.
+ * To bound the latency of a request, a fit search visits at most POOL_FIT_STEPS free blocks in total before
+ * falling back to the top chunk (and failing if that is exhausted too).
+ */
+#define POOL_FIT_STEPS 64
+
+/* Lifetime regions (mymalloc_hint) are REGION_SIZE bytes, requests above REGION_MAX_REQUEST bypass them */
+#define REGION_SIZE (1L << 16)
+#define REGION_MAX_REQUEST (REGION_SIZE / 8)
+
+/* Region kinds: one per lifetime, then one per tag slot (mymalloc_tagged folds tags into TAG_SLOTS slots) */
+#define TAG_SLOTS 64
+#define TAG_KIND(tag) (LIFETIME_PERMANENT + 1 + (tag) % TAG_SLOTS)
+#define REGION_KINDS (LIFETIME_PERMANENT + 1 + TAG_SLOTS)
+
+/* A leading gap myaligned_alloc cannot add to the block below it is made a free block only if it is at least this big,
+ * so that aligned requests do not fill the small free lists with blocks no request takes */
+#define ALIGN_MIN_GAP 64
+
+/* Free blocks are rarely aligned beyond HEAP_ALIGNMENT, so the free list search of myaligned_alloc visits at most this
+ * many of them before carving the block from the top chunk instead */
+#define ALIGN_FIT_STEPS 64
+
+/* mycalloc discards (rather than clears) the whole pages of a reused block at least this big, they read back as zero */
+#define CALLOC_PURGE_MIN (1L << 20)
+
 
 // struct represents memory block header
 typedef struct {
@@ -65,7 +118,7 @@ typedef struct {
 } headerT;
 
 
-void *free_lists[SZ_CLASSES];  // 28 segregated free lists representing 28 size classes starting from (2^4 - (2^5 -1)) to (2^30 - (2^31 -1)
+void *free_lists[SZ_CLASSES];  // 28 segregated free lists representing 28 size classes starting from (2^4 - (2^5 -1)) to (2^31 - (2^32 -1)), then realloc and extended lists
 
 /* The values in this array maps the HIT count for the free lists stored in free_lists (implicit index matching) */
 
@@ -75,6 +128,33 @@ unsigned int hit_counter[SZ_CLASSES];  //counts the number of allocation hits fo
 // global variable to store a pointer to the start of the heap
 void *mem_heap = NULL;      /* points to first byte of heap */
 
+// The top chunk, [top_ptr, top_end) is free space at the end of the heap that is not on any free list
+char *top_ptr = NULL;       /* where the next block is carved from */
+char *top_end = NULL;       /* end of the top chunk, normally the end of the heap segment */
+char *top_fresh = NULL;     /* top chunk memory from here on has never been handed out, so it is still zero-filled */
+headerT *fresh_hdr = NULL;  /* block most recently carved entirely from zero-filled memory, see mycalloc */
+headerT *top_last = NULL;   /* allocated block most recently carved from the top chunk, NULL once freed, see myaligned_alloc */
+
+// header at the start of a region, see mymalloc_hint and mymalloc_tagged
+typedef struct {
+    char *bump;        // header of the next block carved from the region
+    char *end;         // end of the region
+    size_t live;       // blocks carved and not freed yet
+    unsigned kind;     // lifetime or TAG_KIND of the blocks in it
+} regionT;
+
+regionT *regions[REGION_KINDS];             /* current region of each kind, NULL if none (never used for LIFETIME_LONG) */
+regionT *spare_regions = NULL;              /* emptied regions kept for reuse, linked through their bump field */
+
+#define RESET_HOOKS 8
+void (*reset_hooks[RESET_HOOKS])(void);  /* called by myinit before the reset, see myatreset */
+int nreset_hooks = 0;
+
+pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;  /* taken by callers around every heap call, see myheap_lock */
+
+bool pool_mode = FALSE;        /* set by myinit_pool, the heap never grows past the pool */
+unsigned int fit_budget = UINT_MAX;  /* free blocks the current fit search may still visit, see POOL_FIT_STEPS */
+
 
 // Very efficient bitwise round of sz up to nearest multiple of mult
 // does this by adding mult-1 to sz, then masking off the
@@ -103,16 +183,30 @@ static inline void *payload_for_hdr(headerT *header)
     return (char *)header + sizeof(headerT);
 }
 
+// Helper function Given a pointer to block header, access the 64-bit size word of an extended header
+static inline size_t *ext_size_for_hdr (headerT *header)
+{
+    return (size_t *)header - 1;
+}
+
 //Helper function Given a pointer to block header,get a block payload size
 static inline size_t get_size (headerT *header)
 {
+    if (header->payloadsz == EXT_PAYLOADSZ) return *ext_size_for_hdr(header);
     return header->payloadsz;
 }
 
 //Helper function to set a block header to a specific payload size
+//Only blocks laid out with an extended header (see ext_malloc) may be set to sizes above EXT_THRESHOLD,
+//normal blocks never grow that large since their block size is at most EXT_THRESHOLD
 static inline void set_size (headerT *header, size_t size)
 {
-    header->payloadsz = size;
+    if (size > EXT_THRESHOLD) {
+        header->payloadsz = EXT_PAYLOADSZ;
+        *ext_size_for_hdr(header) = size;
+    }
+    else
+        header->payloadsz = size;
 }
 
 //Helper function to set index of a block header
@@ -184,6 +278,214 @@ static inline void split_blk (headerT *original_blk, unsigned short free_lists_i
 
 }
 
+/*Function: retire_top
+ *Helper function to give up on the current top chunk, when the heap segment was extended by someone else
+ *(e.g. ext_malloc) so the top chunk can no longer grow in place. What is left of it becomes a free block,
+ *or an 8-byte padding header (payload 0, marked allocated) if it is too small for one.
+*/
+
+static void retire_top (void)
+{
+    size_t remaining = top_end - top_ptr;
+    if (remaining >= MIN_BLK_SZ) {
+        unsigned short list_indx = free_list_indx(remaining);
+        set_size((headerT *)top_ptr, remaining - sizeof(headerT));
+        set_to_free((headerT *)top_ptr);
+        set_free_lists_index((headerT *)top_ptr, list_indx);
+        memcpy(payload_for_hdr((headerT *)top_ptr), &free_lists[list_indx], sizeof(void *));
+        free_lists[list_indx] = top_ptr;
+    }
+    else if (remaining > 0) {
+        set_size((headerT *)top_ptr, 0);
+        set_to_alloc((headerT *)top_ptr);
+    }
+    top_ptr = top_end = top_fresh = (char *)heap_segment_start() + heap_segment_size();
+    top_last = NULL;
+}
+
+/*Function: grow_top
+ *Helper function that refills the top chunk from extend_heap_segment with just enough pages so it holds at least
+ *nbytes. Returns FALSE if the heap cannot be extended.
+*/
+
+static bool grow_top (size_t nbytes)
+{
+    if (pool_mode) return FALSE;    //the pool is all there is
+    if (top_end != (char *)heap_segment_start() + heap_segment_size()) retire_top();
+    bool misaligned = ((uintptr_t)top_ptr + sizeof(headerT)) % ALIGNMENT != 0;  //only possible with ALIGN16
+    size_t extendsz = roundup(nbytes + (misaligned ? sizeof(headerT) : 0) - (top_end - top_ptr), PAGE_SIZE)/PAGE_SIZE;
+    if (extend_heap_segment(extendsz) == NULL) return FALSE;
+    top_end += extendsz*PAGE_SIZE;
+    if (misaligned) {   //pad so that the headers carved from here are 8 mod 16
+        set_size((headerT *)top_ptr, 0);
+        set_to_alloc((headerT *)top_ptr);
+        top_ptr += sizeof(headerT);
+    }
+    return TRUE;
+}
+
+/*Function: carve_top
+ *Helper function that allocates a block of blocksz bytes (header included) from the top chunk by bumping top_ptr,
+ *refilling the top chunk first when it is too small.
+ *Returns the header of the new block, NULL if the heap cannot be extended.
+*/
+
+static inline headerT *carve_top (size_t blocksz)
+{
+    if ((size_t)(top_end - top_ptr) < blocksz && !grow_top(blocksz)) return NULL;
+    headerT *header = (headerT *)top_ptr;
+    if (top_ptr >= top_fresh) fresh_hdr = header;   //the payload has never been touched
+    top_last = header;
+    top_ptr += blocksz;
+    if (top_ptr > top_fresh) top_fresh = top_ptr;
+    set_size(header, blocksz - sizeof(headerT));
+    set_to_alloc(header);
+    return header;
+}
+
+/*Function: free_blk
+ *Helper function that gives a block back: to the top chunk if it sits right below top_ptr (keeping the tail of
+ *the heap contiguous), otherwise to the front of the free list its header index points to.
+*/
+
+static inline void free_blk (headerT *hdr_ptr)
+{
+    unsigned short index = get_free_lists_index(hdr_ptr);
+    if (hdr_ptr == top_last) top_last = NULL;
+    if (index != EXT_INDEX && next_block_ptr(hdr_ptr, get_size(hdr_ptr)) == top_ptr) {
+        top_ptr = (char *)hdr_ptr;
+        return;
+    }
+    /* copy pointer to next from free_list into payload space in freed block */
+    memcpy (payload_for_hdr(hdr_ptr), &free_lists[index], sizeof(void *));
+    set_to_free(hdr_ptr);
+    free_lists[index] = hdr_ptr;
+}
+
+// Given the header of a block carved from a region, find the region (regions are REGION_SIZE-aligned)
+static inline regionT *region_for_hdr (headerT *header)
+{
+    return (regionT *)((uintptr_t)header & ~(uintptr_t)(REGION_SIZE-1));
+}
+
+// Offset of the first block header in a region, keeps the payloads aligned
+#define REGION_FIRST_HDR (roundup(sizeof(regionT) + sizeof(headerT), ALIGNMENT) - sizeof(headerT))
+
+/*Function: region_free
+ *Helper function that frees a block carved from a region. When the region's last live block goes, the region is
+ *rewound if it is still the current one for its kind, otherwise it is kept as a spare for the next region
+ *(an aligned region could not be cut from an ordinary free block again).
+*/
+
+static void region_free (headerT *hdr_ptr)
+{
+    regionT *region = region_for_hdr(hdr_ptr);
+    set_to_free(hdr_ptr);
+    if (--region->live != 0) return;
+    if (regions[region->kind] == region)
+        region->bump = (char *)region + REGION_FIRST_HDR;
+    else {
+        region->bump = (char *)spare_regions;
+        spare_regions = region;
+    }
+}
+
+/*Function: region_malloc
+ *Helper function that carves a block of blocksz bytes (header included) from the current region of a kind,
+ *starting a new region (a spare one if there is any) when it is full. Returns the payload, NULL if out of memory.
+*/
+
+static void *region_malloc (size_t blocksz, unsigned kind)
+{
+    regionT *region = regions[kind];
+    if (region == NULL || (size_t)(region->end - region->bump) < blocksz) {
+        regionT *fresh = spare_regions;
+        if (fresh != NULL)
+            spare_regions = (regionT *)fresh->bump;
+        else if ((fresh = myaligned_alloc(REGION_SIZE, REGION_SIZE)) == NULL)
+            return NULL;
+        fresh->bump = (char *)fresh + REGION_FIRST_HDR;
+        fresh->end = (char *)fresh + REGION_SIZE;
+        fresh->live = 0;
+        fresh->kind = kind;
+        regions[kind] = fresh;
+        if (region != NULL && region->live == 0) {   //nothing left in the old one
+            region->bump = (char *)spare_regions;
+            spare_regions = region;
+        }
+        region = fresh;
+    }
+
+    headerT *header = (headerT *)region->bump;
+    region->bump += blocksz;
+    region->live++;
+    set_size(header, blocksz - sizeof(headerT));
+    set_to_alloc(header);
+    set_free_lists_index(header, REGION_INDEX);
+    return payload_for_hdr(header);
+}
+
+/* Lifetime prediction (myset_lifetime_prediction)
+ * ------------------------------------------------
+ * Allocations are grouped by call site: the return address of mymalloc hashed together with the size class picks
+ * a slot in sites[]. One allocation in SAMPLE_PERIOD is sampled: its address, slot and the allocation clock go in
+ * samples[] (hashed by address). When a sampled block is freed, or its sample slot is taken over after the block
+ * lived SHORT_LIFETIME_ALLOCS allocations or more, its lifetime is credited to its site as short or long. A site
+ * with mostly short samples has its allocations carved from a short-lived region, all others use the free lists.
+ */
+
+#define SITE_SLOTS 1024              // call sites tracked (power of 2)
+#define SAMPLE_SLOTS 1024            // sampled blocks waiting to be freed (power of 2)
+#define SAMPLE_PERIOD 32             // one allocation in this many is sampled
+#define SHORT_LIFETIME_ALLOCS 1000   // a block freed within this many allocations counts as short-lived
+#define SITE_MIN_SAMPLES 8           // samples needed before a site is predicted short-lived
+#define SITE_SHORT_RATIO 8           // ... and how many times more of them must have died young than lived long
+#define SITE_MAX_SAMPLES 64          // counts are halved at this total, so a site can change its mind
+
+typedef struct {
+    void *site;                      // return address of the call site
+    unsigned short index;            // size class
+    unsigned short nshort, nlong;    // sampled blocks that died young / lived long
+} siteT;
+
+typedef struct {
+    void *ptr;                       // sampled block, NULL if the slot is free
+    void *site;                      // call site that allocated it
+    unsigned slot;                   // its slot in sites[]
+    unsigned long born;              // alloc_clock when it was allocated
+} sampleT;
+
+bool predict_mode = FALSE;           /* lifetime prediction turned on */
+static siteT sites[SITE_SLOTS];      /* only written while prediction is on, cleared when it is turned on or off */
+static sampleT samples[SAMPLE_SLOTS];
+unsigned long alloc_clock = 0;       /* allocations made with prediction on */
+
+static inline unsigned sample_slot (void *ptr)
+{
+    return ((uintptr_t)ptr >> 4) * 0x9E3779B1u % SAMPLE_SLOTS;
+}
+
+// Helper function to credit the lifetime of a sampled block to its site, unless the site slot has been reused
+static void record_lifetime (sampleT *sample)
+{
+    siteT *site = &sites[sample->slot];
+    if (site->site != sample->site) return;
+    if (alloc_clock - sample->born < SHORT_LIFETIME_ALLOCS) site->nshort++; else site->nlong++;
+    if (site->nshort + site->nlong >= SITE_MAX_SAMPLES) {
+        site->nshort >>= 1;
+        site->nlong >>= 1;
+    }
+}
+
+// Helper function called on every free while prediction is on, records the lifetime if the block was sampled
+static inline void unsample (void *ptr)
+{
+    sampleT *sample = &samples[sample_slot(ptr)];
+    if (sample->ptr != ptr) return;
+    record_lifetime(sample);
+    sample->ptr = NULL;
+}
+
 /* The responsibility of the myinit function is to configure a new
  * empty heap. Typically this function will initialize the
  * segment (you decide the initial number pages to set aside, can be
@@ -193,12 +495,28 @@ static inline void split_blk (headerT *original_blk, unsigned short free_lists_i
  * requests are made. It may also be called later to wipe out the current
  * heap contents and start over fresh. This "reset" option is specifically
  * needed by the test harness to run a sequence of scripts, one after another,
- * without restarting program from scratch.
+ * without restarting program from scratch. A reset keeps the segment's
+ * reservation and committed pages (see reset_heap_segment) and only clears
+ * the size-class metadata, so it is cheap enough to do per request.
  */
  
 bool myinit()
 {
-    mem_heap = init_heap_segment(0); // reset heap segment
+    for (int i = 0; i < nreset_hooks; i++) reset_hooks[i]();
+    mem_heap = reset_heap_segment(); // reset heap segment, keeping its reservation
+    if (mem_heap == NULL) return false;
+    top_ptr = top_end = top_fresh = mem_heap;    // empty top chunk, filled on first miss
+    top_last = NULL;
+
+    pool_mode = FALSE;
+    fit_budget = UINT_MAX;
+    for (int i = 0; i < REGION_KINDS; i++) regions[i] = NULL;
+    spare_regions = NULL;
+    if (predict_mode) {                   //what was learned refers to the old heap
+        memset(sites, 0, sizeof(sites));
+        memset(samples, 0, sizeof(samples));
+        alloc_clock = 0;
+    }
 
     /* intialize all free lists and ht_counters. set to NULL & Zero */
     for (int i=0; i<SZ_CLASSES; i++) {
@@ -210,6 +528,35 @@ bool myinit()
     hit_counter[REALLOC_INDEX] = HIT_SENSOR ;   //Force myrealloc to always follow the code path of {# HITS (requests) > HIT_SENSOR}
     return true;
 }
+/* Function: myinit_pool
+ * ---------------------
+ * Configures a new empty heap in pool mode: a pool of bytes (rounded up to whole pages) is committed
+ * and pre-faulted up front and becomes the top chunk. After this no request calls extend_heap_segment,
+ * fit searches are capped at POOL_FIT_STEPS free blocks, and a request the pool cannot serve returns NULL.
+ */
+
+bool myinit_pool(size_t bytes)
+{
+    if (!myinit() || bytes == 0 || bytes > MAX_REQUEST) return false;
+    if (!grow_top(bytes) || !populate_heap_segment(top_ptr, top_end - top_ptr)) return false;
+    pool_mode = TRUE;
+    return true;
+}
+
+/* Function: myatreset
+ * -------------------
+ * Adds fn to the hooks myinit calls, unless it is there already.
+ */
+
+bool myatreset(void (*fn)(void))
+{
+    for (int i = 0; i < nreset_hooks; i++)
+        if (reset_hooks[i] == fn) return true;
+    if (nreset_hooks == RESET_HOOKS) return false;
+    reset_hooks[nreset_hooks++] = fn;
+    return true;
+}
+
 /* Function: find_fit
  * ------------------
  * Helper function to look for a size request fit in the free linked list, return NULL if NO fit
@@ -227,7 +574,9 @@ static  void *find_fit(size_t size, unsigned short free_lists_index, bool split)
 
 
     /* loop through the free linked list to find a fit, return a pointer to the found block otherwise return NULL */
-    for (hdr_ptr = free_lists[free_lists_index]; hdr_ptr != NULL ; prev_hdr_ptr = hdr_ptr,  hdr_ptr = *(void **)payload_for_hdr(hdr_ptr)){
+    for (hdr_ptr = free_lists[free_lists_index]; hdr_ptr != NULL && fit_budget != 0; prev_hdr_ptr = hdr_ptr,  hdr_ptr = *(void **)payload_for_hdr(hdr_ptr)){
+
+        fit_budget--;
 
         if (size <= get_size(hdr_ptr)){      //check if requested size is less than or equal a free block
 
@@ -278,65 +627,141 @@ static  void *find_fit(size_t size, unsigned short free_lists_index, bool split)
 
 }
 
-// malloc a block by rounding up size to number of pages, extending heap
-// segment and using most recently added page(s) for this block. This
-// means each block gets its own page -- how generous! :-)
+/* Function: ext_malloc
+ * -------------------
+ * Allocation path for requests too large for the 32-bit payloadsz. First-fit search
+ * of the extended free list without splitting, otherwise a fresh run of pages whose
+ * first word holds the 64-bit payload size, followed by the normal header.
+ */
 
-void *mymalloc(size_t requestedsz)
+static void *ext_malloc(size_t requestedsz)
 {
-    size_t adjustedsz;  /* Adjusted block size to comply with Alignment and min block size requirement */
-    size_t extendsz;    /* # of pages to extend heap if no fit */
+    size_t payloadsz = roundup(requestedsz, ALIGNMENT);
     void *bp;
 
-    /* ignore spurious requests */
-    if (requestedsz == 0 || requestedsz > INT_MAX) return NULL;
+    hit_counter[EXT_INDEX]++;
+    if ((bp = find_fit(payloadsz, EXT_INDEX, FALSE)) != NULL)
+        return payload_for_hdr(bp);
+    if (pool_mode) return NULL;
+
+    size_t extendsz = roundup(payloadsz + EXT_HDR_SZ, PAGE_SIZE)/PAGE_SIZE;
+    if ((bp = extend_heap_segment(extendsz)) == NULL) return NULL;
+    headerT *header = (headerT *)((char *)bp + sizeof(size_t));
+    fresh_hdr = header;                                 // fresh pages, the payload is zero-filled
+    set_size(header, extendsz*PAGE_SIZE - EXT_HDR_SZ);  // the whole page run is payload
+    set_to_alloc(header);
+    set_free_lists_index(header, EXT_INDEX);
+    return payload_for_hdr(header);
+}
 
-    /* Adjust block size */
-    adjustedsz = roundup(requestedsz + sizeof(headerT), ALIGNMENT);
+/* Function: list_malloc
+ * ---------------------
+ * Helper function for the free list part of mymalloc: searches the segregated free lists for a block of
+ * adjustedsz bytes (header included), starting at its size class. Returns its header, NULL if no fit was found.
+ */
 
+static headerT *list_malloc(size_t adjustedsz)
+{
+    void *bp;
     unsigned short index = free_list_indx(adjustedsz);   //calculate the index in the free_lists array that points to the correct size class
     hit_counter[index]++;                //increase the hit count for this specific free list class by one
     /* Search the free list for a first fit */
     for (int i=0; i<REALLOC_INDEX; i++){   //till 26 index, last index is reserved for realloc use only
         if ((bp = find_fit(adjustedsz - sizeof(headerT), i, TRUE)) != NULL){
              set_free_lists_index(bp, i);
-             return payload_for_hdr(bp);
+             return bp;
         }
-        if (hit_counter[index] >= HIT_SENSOR) break;
+        if (hit_counter[index] >= HIT_SENSOR || fit_budget == 0) break;
     }
+    return NULL;
+}
 
-    /* No fit found. Get more memory and place the block */
-    extendsz = roundup(adjustedsz, PAGE_SIZE)/PAGE_SIZE;
-    size_t size_diff = 0;
-    size_t extended_sz = extendsz*PAGE_SIZE;
-    if ((bp = extend_heap_segment(extendsz)) == NULL) return NULL;       //optimize here if before it is free coelse
-    set_free_lists_index(bp,index);
-
-
-    /* Split the free space if the size difference after splitting (the remainder) is greater than or equal the minimum block size 16 bytes */
-    if((size_diff = (extended_sz - adjustedsz)) >= MIN_BLK_SZ){
-
-          if (hit_counter[index] >= HIT_SENSOR){
-               //hit_counter[index]--;
-               
-               /* Split, Match the remainder free block with the same free list, Insert it to the begining of that list */
-               split_blk (bp, index, (adjustedsz-sizeof(headerT)), size_diff);
-          }
-          else {
-               /* Match the remainder free block with the right free list and insert it to the begining of that list */
-               unsigned short list_indx = free_list_indx(size_diff);
-
-               /*&free_list to keep linked list intact and insert the new free block at the begining of the list */
-               split_blk (bp, list_indx, (adjustedsz-sizeof(headerT)), size_diff);
-          }
-    }
-    else {
-         set_size(bp, (extended_sz - sizeof(headerT)));   //No split give away the whole memory block
-         set_to_alloc(bp);
-    }
+// malloc a block by rounding up size to number of pages, extending heap
+// segment and using most recently added page(s) for this block. This
+// means each block gets its own page -- how generous! :-)
+// (the mymalloc path without lifetime prediction)
+
+static void *heap_malloc(size_t requestedsz)
+{
+    size_t adjustedsz;  /* Adjusted block size to comply with Alignment and min block size requirement */
+    void *bp;
+
+    /* ignore spurious requests */
+    if (requestedsz == 0 || requestedsz > MAX_REQUEST) return NULL;
+
+    fit_budget = pool_mode ? POOL_FIT_STEPS : UINT_MAX;   //fresh fit search budget for this request
+
+    /* Adjust block size */
+    adjustedsz = roundup(requestedsz + sizeof(headerT), ALIGNMENT);
+    if (adjustedsz > EXT_THRESHOLD) return ext_malloc(requestedsz);
+
+    if ((bp = list_malloc(adjustedsz)) != NULL) return payload_for_hdr(bp);
+
+    /* No fit found. Carve the block from the top chunk (getting more memory if needed) */
+    if ((bp = carve_top(adjustedsz)) == NULL) return NULL;
+    set_free_lists_index(bp, free_list_indx(adjustedsz));
     return payload_for_hdr(bp);
 }
 
+/* Function: predicted_malloc
+ * --------------------------
+ * Helper function for mymalloc while lifetime prediction is on: looks up the call site, places the block in a
+ * short-lived region if the site is predicted short-lived, and samples one allocation in SAMPLE_PERIOD.
+ */
+
+static void *predicted_malloc(size_t requestedsz, void *caller)
+{
+    if (requestedsz == 0 || requestedsz > REGION_MAX_REQUEST) return heap_malloc(requestedsz);
+
+    size_t adjustedsz = roundup(requestedsz + sizeof(headerT), ALIGNMENT);
+    unsigned short index = free_list_indx(adjustedsz);
+    unsigned slot = ((uintptr_t)caller * 0x9E3779B1u ^ index) % SITE_SLOTS;
+    siteT *site = &sites[slot];
+    if (site->site != caller || site->index != index) {   //a new site takes the slot over
+        site->site = caller;
+        site->index = index;
+        site->nshort = site->nlong = 0;
+    }
+
+    void *ptr;
+    if (site->nshort >= SITE_MIN_SAMPLES && site->nshort > SITE_SHORT_RATIO*site->nlong)
+        ptr = region_malloc(adjustedsz, LIFETIME_SHORT);
+    else
+        ptr = heap_malloc(requestedsz);
+    if (ptr == NULL || ++alloc_clock % SAMPLE_PERIOD != 0) return ptr;
+
+    sampleT *sample = &samples[sample_slot(ptr)];
+    if (sample->ptr != NULL && alloc_clock - sample->born >= SHORT_LIFETIME_ALLOCS)
+        record_lifetime(sample);   //lived long and is still alive
+    *sample = (sampleT){.ptr = ptr, .site = caller, .slot = slot, .born = alloc_clock};
+    return ptr;
+}
+
+/* Function: mymalloc
+ * ------------------
+ * Entry point of malloc, takes the prediction path when lifetime prediction is on.
+ */
+
+void *mymalloc(size_t requestedsz)
+{
+    if (predict_mode) return predicted_malloc(requestedsz, __builtin_return_address(0));
+    return heap_malloc(requestedsz);
+}
+
+
+/* Function: myset_lifetime_prediction
+ * -----------------------------------
+ * Turns lifetime prediction on or off, forgetting what was learned so far.
+ */
+
+void myset_lifetime_prediction(bool enable)
+{
+    predict_mode = enable;
+    memset(sites, 0, sizeof(sites));
+    memset(samples, 0, sizeof(samples));
+    alloc_clock = 0;
+}
+
 
 // free does nothing.  fast!... but lame :(
 void myfree(void *ptr)
@@ -344,12 +769,296 @@ void myfree(void *ptr)
     if (ptr){
        /* insert freed block to the front of the free list, copy pointer to next from free_list into payload space in freed block */
        void *hdr_ptr = hdr_for_payload(ptr);  //pointer to the header of the freed block
-       unsigned short index = get_free_lists_index(hdr_ptr);
-       hit_counter[index]--;
-       memcpy (ptr, &free_lists[index], sizeof(void *));
-       set_to_free(hdr_ptr);
-       free_lists[index] = hdr_ptr;
+       if (predict_mode) unsample(ptr);
+       if (get_free_lists_index(hdr_ptr) == REGION_INDEX) {
+           region_free(hdr_ptr);
+           return;
+       }
+       hit_counter[get_free_lists_index(hdr_ptr)]--;
+       free_blk(hdr_ptr);
+    }
+}
+
+
+/* Function: mymalloc_at_least
+ * ---------------------------
+ * mymalloc that also reports, through usable (if not NULL), the payload size the block really got. Set to 0 when
+ * the allocation fails.
+ */
+
+void *mymalloc_at_least(size_t size, size_t *usable)
+{
+    void *ptr = mymalloc(size);
+    if (usable != NULL) *usable = (ptr == NULL) ? 0 : get_size(hdr_for_payload(ptr));
+    return ptr;
+}
+
+
+/* Function: myusable_size
+ * -----------------------
+ * Payload size of the block at ptr, as recorded in its header (or extended header). 0 for NULL.
+ */
+
+size_t myusable_size(void *ptr)
+{
+    return (ptr == NULL) ? 0 : get_size(hdr_for_payload(ptr));
+}
+
+
+/* Function: unlink_free_blk
+ * -------------------------
+ * Helper function that takes a free block off its free list, searching the list (within fit_budget) for it.
+ * Returns FALSE if it is not on the list, so this also tells a real free block from bytes that merely look like
+ * a free header (e.g. the size word in front of an extended block).
+ */
+
+static bool unlink_free_blk (headerT *target)
+{
+    unsigned short index = get_free_lists_index(target);
+    if (index > REALLOC_INDEX) return FALSE;   //extended blocks are never merged
+    void *prev_hdr_ptr = NULL;
+    for (void *hdr_ptr = free_lists[index]; hdr_ptr != NULL && fit_budget != 0; prev_hdr_ptr = hdr_ptr, hdr_ptr = *(void **)payload_for_hdr(hdr_ptr)) {
+        fit_budget--;
+        if (hdr_ptr != target) continue;
+        if (prev_hdr_ptr == NULL)
+            memcpy(&free_lists[index], payload_for_hdr(hdr_ptr), sizeof(void *));
+        else
+            memcpy(payload_for_hdr(prev_hdr_ptr), payload_for_hdr(hdr_ptr), sizeof(void *));
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+/* Function: mytry_expand
+ * ----------------------
+ * Grows the block at ptr without moving it, to preferred_size if possible and at least min_size, and returns its
+ * new usable size. Tries, in order, the slack the block already has, the top chunk when the block sits right
+ * below top_ptr, and the block that follows it when that one is free (any excess is split off again).
+ * Returns 0 and leaves the heap untouched if none of these reaches min_size.
+ */
+
+size_t mytry_expand(void *ptr, size_t min_size, size_t preferred_size)
+{
+    if (ptr == NULL) return 0;
+    headerT *hdr_ptr = hdr_for_payload(ptr);
+    size_t cursz = get_size(hdr_ptr);
+    if (min_size <= cursz) return cursz;   //fits in the slack already
+    if (hdr_ptr->payloadsz == EXT_PAYLOADSZ || get_free_lists_index(hdr_ptr) == REGION_INDEX ||
+        roundup(min_size + sizeof(headerT), ALIGNMENT) > EXT_THRESHOLD) return 0;
+
+    /* payload sizes that keep the block size a multiple of ALIGNMENT, preferred capped at the largest normal block */
+    size_t need = roundup(min_size + sizeof(headerT), ALIGNMENT) - sizeof(headerT);
+    size_t want = (preferred_size > EXT_THRESHOLD - sizeof(headerT)) ? EXT_THRESHOLD - sizeof(headerT)
+                  : roundup((preferred_size > min_size ? preferred_size : min_size) + sizeof(headerT), ALIGNMENT) - sizeof(headerT);
+    char *end = next_block_ptr(hdr_ptr, cursz);
+    fit_budget = pool_mode ? POOL_FIT_STEPS : UINT_MAX;
+
+    /* The heap tail: take from the top chunk, refilling it if it can still grow in place */
+    if (end == top_ptr) {
+        if ((size_t)(top_end - top_ptr) < want - cursz && top_end == (char *)heap_segment_start() + heap_segment_size())
+            grow_top(want - cursz);
+        size_t avail = (top_end - top_ptr) & ~((size_t)ALIGNMENT-1);
+        size_t take = (want - cursz < avail) ? want - cursz : avail;
+        if (cursz + take < need) return 0;
+        top_ptr += take;
+        if (top_ptr > top_fresh) top_fresh = top_ptr;
+        top_last = hdr_ptr;
+        set_size(hdr_ptr, cursz + take);
+        return cursz + take;
+    }
+
+    /* A free neighbour: merge it in, then split off what is not wanted */
+    headerT *next = (headerT *)end;
+    if (end > top_ptr || next->alloc != 0) return 0;
+    size_t total = cursz + sizeof(headerT) + get_size(next);
+    if (total < need || !unlink_free_blk(next)) return 0;
+    size_t newsz = (total < want) ? total : want;
+    if (total - newsz >= MIN_BLK_SZ) {
+        headerT *rest = next_block_ptr(hdr_ptr, newsz);
+        set_size(rest, total - newsz - sizeof(headerT));
+        set_free_lists_index(rest, free_list_indx(total - newsz));
+        free_blk(rest);
     }
+    else
+        newsz = total;
+    set_size(hdr_ptr, newsz);
+    return newsz;
+}
+
+
+/* Function: mymalloc_group
+ * ------------------------
+ * Co-allocates n objects in one block: each object starts at the next ALIGNMENT boundary after the previous one,
+ * so the block costs a single header and a single search. Returns the block (which is also out[0]).
+ */
+
+void *mymalloc_group(const size_t sizes[], size_t n, void *out[])
+{
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sizes[i] > MAX_REQUEST) return NULL;
+        total += roundup(sizes[i], ALIGNMENT);
+        if (total > MAX_REQUEST) return NULL;
+    }
+    char *block = mymalloc(total);
+    if (block == NULL) return NULL;
+    for (size_t i = 0, offset = 0; i < n; offset += roundup(sizes[i], ALIGNMENT), i++)
+        out[i] = block + offset;
+    return block;
+}
+
+
+/* Function: mymalloc_batch
+ * ------------------------
+ * Allocates up to n blocks of size bytes into out[] and returns how many it got. The size class, hit_counter
+ * update and search are done once for the batch: a single pass over the size class's free list takes every block
+ * that fits, cutting as many blocks out of each as it holds (what is left keeps its place in the list, or moves
+ * to the list of its own size class), and the rest are cut from one run of the top chunk.
+ */
+
+size_t mymalloc_batch(size_t size, size_t n, void *out[])
+{
+    size_t got = 0;
+    if (size == 0 || size > MAX_REQUEST || n == 0) return 0;
+
+    size_t adjustedsz = roundup(size + sizeof(headerT), ALIGNMENT);
+    if (adjustedsz > EXT_THRESHOLD) {   //page-sized blocks, nothing to share between them
+        while (got < n && (out[got] = mymalloc(size)) != NULL) got++;
+        return got;
+    }
+    unsigned short index = free_list_indx(adjustedsz);
+    fit_budget = (pool_mode && n < UINT_MAX/POOL_FIT_STEPS) ? n*POOL_FIT_STEPS : UINT_MAX;   //the budget of n requests
+
+    /* One pass over the free list of the size class */
+    void *prev_hdr_ptr = NULL;
+    void *hdr_ptr = free_lists[index];
+    while (hdr_ptr != NULL && got < n && fit_budget != 0) {
+        void *next_hdr_ptr = *(void **)payload_for_hdr(hdr_ptr);
+        size_t blksz = get_size(hdr_ptr) + sizeof(headerT);
+        fit_budget--;
+        if (blksz < adjustedsz) {
+            prev_hdr_ptr = hdr_ptr;
+            hdr_ptr = next_hdr_ptr;
+            continue;
+        }
+
+        /* Cut blocks off the front, the last one taking the whole remainder if it is too small to be a block */
+        char *cut = hdr_ptr;
+        while (got < n && blksz >= adjustedsz) {
+            size_t cutsz = (blksz - adjustedsz < MIN_BLK_SZ) ? blksz : adjustedsz;
+            set_size((headerT *)cut, cutsz - sizeof(headerT));
+            set_to_alloc((headerT *)cut);
+            set_free_lists_index((headerT *)cut, index);
+            out[got++] = payload_for_hdr((headerT *)cut);
+            cut += cutsz;
+            blksz -= cutsz;
+        }
+
+        /* Unlink the block, then put back what is left of it */
+        void **link = (prev_hdr_ptr == NULL) ? &free_lists[index] : (void **)payload_for_hdr(prev_hdr_ptr);
+        memcpy(link, &next_hdr_ptr, sizeof(void *));
+        if (blksz > 0) {
+            unsigned short list_indx = (hit_counter[index] >= HIT_SENSOR) ? index : free_list_indx(blksz);
+            set_size((headerT *)cut, blksz - sizeof(headerT));
+            set_to_free((headerT *)cut);
+            set_free_lists_index((headerT *)cut, list_indx);
+            if (list_indx == index) {   //takes the place of the block it was cut from
+                memcpy(payload_for_hdr((headerT *)cut), &next_hdr_ptr, sizeof(void *));
+                memcpy(link, &cut, sizeof(void *));
+                prev_hdr_ptr = cut;
+            }
+            else {
+                memcpy(payload_for_hdr((headerT *)cut), &free_lists[list_indx], sizeof(void *));
+                free_lists[list_indx] = cut;
+            }
+        }
+        hdr_ptr = next_hdr_ptr;
+    }
+
+    /* The rest from one run of the top chunk, as much of it as the heap can give (no heap grows past MAX_REQUEST,
+     * capping the count there also keeps the product from wrapping) */
+    size_t more = (n - got < MAX_REQUEST / adjustedsz) ? n - got : MAX_REQUEST / adjustedsz;
+    size_t want = more * adjustedsz;
+    if (want > 0 && (size_t)(top_end - top_ptr) < want && !grow_top(want))
+        want = (top_end - top_ptr) / adjustedsz * adjustedsz;
+    if ((size_t)(top_end - top_ptr) >= want) {
+        for (; want > 0; want -= adjustedsz) {
+            headerT *header = (headerT *)top_ptr;
+            top_ptr += adjustedsz;
+            set_size(header, adjustedsz - sizeof(headerT));
+            set_to_alloc(header);
+            set_free_lists_index(header, index);
+            out[got++] = payload_for_hdr(header);
+            top_last = header;
+        }
+        if (top_ptr > top_fresh) top_fresh = top_ptr;
+    }
+    hit_counter[index] += got;
+    return got;
+}
+
+
+/* Function: myfree_batch
+ * ----------------------
+ * Frees n blocks (NULL entries are skipped). Blocks right below top_ptr go back to the top chunk as in myfree,
+ * the others are chained up per free list and each chain is spliced onto the front of its list in one go.
+ */
+
+void myfree_batch(void *ptrs[], size_t n)
+{
+    void *heads[SZ_CLASSES] = {NULL};
+    void *tails[SZ_CLASSES];
+
+    for (size_t i = 0; i < n; i++) {
+        if (ptrs[i] == NULL) continue;
+        headerT *hdr_ptr = hdr_for_payload(ptrs[i]);
+        unsigned short index = get_free_lists_index(hdr_ptr);
+        if (predict_mode) unsample(ptrs[i]);
+        if (index == REGION_INDEX) {
+            region_free(hdr_ptr);
+            continue;
+        }
+        hit_counter[index]--;
+        if (hdr_ptr == top_last) top_last = NULL;
+        if (index != EXT_INDEX && next_block_ptr(hdr_ptr, get_size(hdr_ptr)) == top_ptr) {
+            top_ptr = (char *)hdr_ptr;
+            continue;
+        }
+        set_to_free(hdr_ptr);
+        memcpy(payload_for_hdr(hdr_ptr), &heads[index], sizeof(void *));
+        if (heads[index] == NULL) tails[index] = hdr_ptr;
+        heads[index] = hdr_ptr;
+    }
+    for (int i = 0; i < SZ_CLASSES; i++) {
+        if (heads[i] == NULL) continue;
+        memcpy(payload_for_hdr(tails[i]), &free_lists[i], sizeof(void *));
+        free_lists[i] = heads[i];
+    }
+}
+
+
+/* Function: myfree_sized
+ * ----------------------
+ * Frees a block whose size the caller knows. Freeing writes the block's header anyway (free_blk marks it free and
+ * reads its size to spot the top chunk), and the header sits right before the payload, so the size saves nothing
+ * and the block is freed by myfree. Built with -DCHECK_SIZED_FREE, the size is checked against the header first
+ * and a mismatch aborts.
+ */
+
+void myfree_sized(void *ptr, size_t size)
+{
+#ifdef CHECK_SIZED_FREE
+    headerT *hdr_ptr = (ptr == NULL) ? NULL : hdr_for_payload(ptr);
+    bool ext = roundup(size + sizeof(headerT), ALIGNMENT) > EXT_THRESHOLD;
+    if (hdr_ptr != NULL && (hdr_ptr->alloc != 1 || size == 0 || size > get_size(hdr_ptr) ||
+                            ext != (hdr_ptr->payloadsz == EXT_PAYLOADSZ))) {
+        fprintf(stderr, "myfree_sized: size %zu does not match block %p (payload %zu, alloc %d)\n",
+                size, ptr, get_size(hdr_ptr), hdr_ptr->alloc);
+        abort();
+    }
+#endif
+    myfree(ptr);
 }
 
 
@@ -366,16 +1075,24 @@ void *myrealloc(void *oldptr, size_t newsz)
     void *bp;
     if (oldptr) {
         size_t oldsz = get_size(hdr_for_payload(oldptr));
-        if (newsz == 0 || newsz > INT_MAX) return NULL;
+        if (newsz == 0 || newsz > MAX_REQUEST) return NULL;
         if (newsz <= oldsz)
              return oldptr;
 
+        /* Too big for the doubled realloc block to fit a normal header, let mymalloc pick the extended path */
+        if ((roundup(newsz + sizeof(headerT), ALIGNMENT) << 1) > EXT_THRESHOLD) {
+             if ((newptr = mymalloc(newsz)) == NULL) return NULL;
+             memcpy(newptr, oldptr, oldsz);
+             myfree(oldptr);
+             return newptr;
+        }
+
         size_t adjustedsz;  /* Adjusted block size to comply with Alignment and min block size requirement */
-        size_t extendsz;    /* Amount to extend heap if no fit */
 
         /* Adjust block size give it double of adjusted size since its realloc to account for future realloc in the same block*/
         adjustedsz =  (roundup(newsz + sizeof(headerT), ALIGNMENT)) << 1;
 
+        fit_budget = pool_mode ? POOL_FIT_STEPS : UINT_MAX;
         if ((bp = find_fit(adjustedsz - sizeof(headerT), REALLOC_INDEX, TRUE)) != NULL) {
              set_free_lists_index(bp, REALLOC_INDEX);
              newptr = payload_for_hdr(bp);
@@ -385,28 +1102,12 @@ void *myrealloc(void *oldptr, size_t newsz)
              return newptr;
         }
 
-         /* No fit found. Get more memory and place the block */
-         extendsz = roundup((adjustedsz), PAGE_SIZE)/PAGE_SIZE;
-         size_t extended_sz = extendsz*PAGE_SIZE;
-         if ((bp = extend_heap_segment(extendsz)) == NULL) return NULL;
+         /* No fit found. Carve the block from the top chunk (getting more memory if needed) */
+         if ((bp = carve_top(adjustedsz)) == NULL) return NULL;
          set_free_lists_index(bp, REALLOC_INDEX);
-         size_t size_diff = extended_sz - adjustedsz;
          newptr = payload_for_hdr(bp);
-
-          if(size_diff  >= MIN_BLK_SZ){
-          	
-             /* Split, Match the remainder free block with the same free list, Insert it to the begining of that list */
-             split_blk (bp, REALLOC_INDEX, (adjustedsz-sizeof(headerT)), size_diff);
-             
-             memcpy(newptr, oldptr, oldsz);
-             myfree(oldptr);
-             return newptr;
-
-          }
          memcpy(newptr, oldptr, oldsz);
          myfree(oldptr);
-         set_size(bp, (extended_sz - sizeof(headerT)));   //No split give away the whole memory block
-         set_to_alloc(bp);
     }
 
     /*void *newptr = mymalloc(newsz);
@@ -421,6 +1122,234 @@ void *myrealloc(void *oldptr, size_t newsz)
 }
 
 
+/* Function: mycalloc
+ * ------------------
+ * Allocates through mymalloc and zeroes the block, skipping the work when possible. A block carved from top
+ * chunk memory that was never handed out since it was committed or purged (fresh_hdr) is already zero-filled.
+ * Otherwise large blocks have their whole pages purged (they fault back in as zero) and only the partial pages
+ * at either end cleared (whole huge pages in a SEGMENT_HUGEPAGES segment, a partial purge would split one); the
+ * rest are cleared with memset, which glibc implements with vector stores.
+ */
+
+void *mycalloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) return NULL;
+    fresh_hdr = NULL;
+    char *ptr = mymalloc(total);
+    if (ptr == NULL || hdr_for_payload(ptr) == fresh_hdr) return ptr;
+
+    if (total >= CALLOC_PURGE_MIN && !pool_mode) {  //pool mode must not take page faults later
+        size_t unit = (heap_segment_options() & SEGMENT_HUGEPAGES) ? HUGE_PAGE_SIZE : PAGE_SIZE;  //what purge discards
+        char *first = (char *)roundup((uintptr_t)ptr, unit);
+        char *last = (char *)((uintptr_t)(ptr + total) & ~((uintptr_t)unit-1));
+        if (last <= first) first = last = ptr;   //no whole unit inside the block
+        if (purge_heap_segment(first, last - first)) {
+            memset(ptr, 0, first - ptr);
+            memset(last, 0, ptr + total - last);
+            return ptr;
+        }
+    }
+    memset(ptr, 0, total);
+    return ptr;
+}
+
+
+/*Function: free_range
+ *Helper function that makes a free block of the nbytes (header included, at least MIN_BLK_SZ) at start.
+*/
+
+static inline void free_range (char *start, size_t nbytes)
+{
+    set_size((headerT *)start, nbytes - sizeof(headerT));
+    set_to_free((headerT *)start);
+    set_free_lists_index((headerT *)start, free_list_indx(nbytes));
+    free_blk((headerT *)start);
+}
+
+// Helper function to compute how far past payload an aligned payload may start when the bytes before it
+// must become a free block: no gap at all, or one of at least ALIGN_MIN_GAP
+static inline size_t aligned_gap (char *payload, size_t align)
+{
+    size_t gap = roundup((uintptr_t)payload, align) - (uintptr_t)payload;
+    if (gap != 0 && gap < ALIGN_MIN_GAP) gap += roundup(ALIGN_MIN_GAP - gap, align);
+    return gap;
+}
+
+/*Function: aligned_fit
+ *Helper function for myaligned_alloc: first-fit search of the free lists, from the size class of blocksz on, for a
+ *free block that holds blocksz bytes (header included) at a payload aligned to align, leaving a leading gap that is
+ *either empty or big enough to be a free block (see aligned_gap). The gap and any trailing slack of at least
+ *MIN_BLK_SZ go back to the free lists. Returns the header of the aligned block, NULL if no fit was found.
+*/
+
+static headerT *aligned_fit (size_t blocksz, size_t align)
+{
+    unsigned short index = free_list_indx(blocksz);
+    for (int i = index; i < REALLOC_INDEX; i++) {
+        void *prev_hdr_ptr = NULL;
+        for (void *hdr_ptr = free_lists[i]; hdr_ptr != NULL && fit_budget != 0; prev_hdr_ptr = hdr_ptr, hdr_ptr = *(void **)payload_for_hdr(hdr_ptr)) {
+            fit_budget--;
+            size_t total = get_size(hdr_ptr) + sizeof(headerT);
+            size_t gap = aligned_gap(payload_for_hdr(hdr_ptr), align);
+            if (gap + blocksz > total) continue;
+
+            if (prev_hdr_ptr == NULL)
+                memcpy(&free_lists[i], payload_for_hdr(hdr_ptr), sizeof(void *));
+            else
+                memcpy(payload_for_hdr(prev_hdr_ptr), payload_for_hdr(hdr_ptr), sizeof(void *));
+            headerT *header = (headerT *)((char *)hdr_ptr + gap);
+            if (gap != 0) free_range(hdr_ptr, gap);
+            size_t slack = total - gap - blocksz;
+            set_size(header, (slack >= MIN_BLK_SZ ? blocksz : blocksz + slack) - sizeof(headerT));
+            set_to_alloc(header);
+            if (slack >= MIN_BLK_SZ) free_range((char *)header + blocksz, slack);
+            return header;
+        }
+        if (hit_counter[index] >= HIT_SENSOR || fit_budget == 0) break;
+    }
+    return NULL;
+}
+
+// Helper function to find the block right below top_ptr, if it is top_last (allocated, so it can be grown), else NULL
+static inline headerT *top_below (void)
+{
+    if (top_last == NULL || next_block_ptr(top_last, get_size(top_last)) != top_ptr) return NULL;
+    return top_last;
+}
+
+/*Function: carve_top_aligned
+ *Helper function that carves a block of blocksz bytes (header included) with a payload aligned to align from the top
+ *chunk, refilling the top chunk first when it is too small. The leading gap is added to the block right below top_ptr
+ *when that one is known (see top_below), so back-to-back aligned blocks leave nothing behind. Otherwise it becomes a
+ *free block, pushed out to ALIGN_MIN_GAP bytes or more. Returns the header, NULL if the heap cannot be extended.
+*/
+
+static headerT *carve_top_aligned (size_t blocksz, size_t align)
+{
+    headerT *below = top_below();
+    char *payload = top_ptr + sizeof(headerT);
+    size_t gap = below ? roundup((uintptr_t)payload, align) - (uintptr_t)payload : aligned_gap(payload, align);
+    if ((size_t)(top_end - top_ptr) < gap + blocksz) {
+        if (!grow_top(blocksz + align + ALIGN_MIN_GAP)) return NULL;   //room for the worst gap
+        below = top_below();
+        payload = top_ptr + sizeof(headerT);
+        gap = below ? roundup((uintptr_t)payload, align) - (uintptr_t)payload : aligned_gap(payload, align);
+    }
+
+    char *start = top_ptr;
+    headerT *header = (headerT *)(top_ptr + gap);
+    if ((char *)header >= top_fresh) fresh_hdr = header;
+    top_ptr = (char *)header + blocksz;
+    if (top_ptr > top_fresh) top_fresh = top_ptr;
+    top_last = header;
+    set_size(header, blocksz - sizeof(headerT));
+    set_to_alloc(header);
+    if (gap != 0) {
+        if (below != NULL)
+            set_size(below, get_size(below) + gap);
+        else
+            free_range(start, gap);
+    }
+    return header;
+}
+
+/* Function: myaligned_alloc
+ * --------------------------
+ * Looks for a free block that already holds an aligned payload of the size (see aligned_fit), else carves one from
+ * the top chunk (see carve_top_aligned). Neither leaves a leading gap smaller than ALIGN_MIN_GAP on the free lists,
+ * so a long run of aligned requests does not slow the first-fit searches down. The block is counted in and indexed
+ * by its size class, as mymalloc would, so myfree keeps hit_counter balanced.
+ */
+
+void *myaligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align-1)) != 0) return NULL;   // not a power of 2
+    if (align <= ALIGNMENT) return mymalloc(size);
+    if (size == 0 || size > MAX_REQUEST || align > MAX_REQUEST) return NULL;
+
+    size_t blocksz = roundup(size + sizeof(headerT), ALIGNMENT);
+    /* blocks with an extended header are never cut up, alignment beyond their fixed layout is not supported */
+    if (blocksz + align + ALIGN_MIN_GAP > EXT_THRESHOLD) return NULL;
+
+    fit_budget = pool_mode ? POOL_FIT_STEPS : ALIGN_FIT_STEPS;   //fresh fit search budget for this request
+    unsigned short index = free_list_indx(blocksz);
+    hit_counter[index]++;
+    headerT *hdr_ptr = aligned_fit(blocksz, align);
+    if (hdr_ptr == NULL && (hdr_ptr = carve_top_aligned(blocksz, align)) == NULL) return NULL;
+    set_free_lists_index(hdr_ptr, index);
+    return payload_for_hdr(hdr_ptr);
+}
+
+
+/* Function: mymalloc_hint
+ * -----------------------
+ * Allocation with a lifetime hint. Long-lived requests (and any request above REGION_MAX_REQUEST) take the normal
+ * mymalloc path. Short-lived and permanent ones are carved from the current region of that lifetime, a new region
+ * (a spare one if there is any) being started when it is full. A full region stays until its last block is freed and
+ * is then reused whole, so short-lived blocks never pin memory among the long-lived ones.
+ */
+
+void *mymalloc_hint(size_t size, lifetime_t lifetime)
+{
+    if (size == 0 || size > REGION_MAX_REQUEST || lifetime == LIFETIME_LONG || lifetime > LIFETIME_PERMANENT)
+        return heap_malloc(size);
+
+    size_t blocksz = roundup(size + sizeof(headerT), ALIGNMENT);
+    void *bp;
+    if (lifetime == LIFETIME_PERMANENT) {   //fill a hole the free lists have, if any, it will not be reopened
+        fit_budget = pool_mode ? POOL_FIT_STEPS : UINT_MAX;
+        if ((bp = list_malloc(blocksz)) != NULL) return payload_for_hdr(bp);
+        hit_counter[free_list_indx(blocksz)]--;   //region blocks are not counted
+    }
+    return region_malloc(blocksz, lifetime);
+}
+
+
+/* Function: mymalloc_tagged
+ * -------------------------
+ * Allocation that keeps the blocks of one tag together: they are carved one after the other from the current
+ * region of the tag, a new region being started when it is full. Requests above REGION_MAX_REQUEST take the normal
+ * path. The space of freed tagged blocks is reused once their whole region is empty.
+ */
+
+void *mymalloc_tagged(size_t size, unsigned tag)
+{
+    if (size == 0 || size > REGION_MAX_REQUEST) return heap_malloc(size);
+    return region_malloc(roundup(size + sizeof(headerT), ALIGNMENT), TAG_KIND(tag));
+}
+
+
+/* Function: myreserve
+ * -------------------
+ * Grows the top chunk so it holds at least bytes and pre-faults those pages, so that the
+ * allocations carved from it later take no page faults and make no syscalls.
+ */
+
+bool myreserve(size_t bytes)
+{
+    if (bytes > MAX_REQUEST) return false;
+    if ((size_t)(top_end - top_ptr) < bytes && !grow_top(bytes)) return false;
+    return populate_heap_segment(top_ptr, bytes);
+}
+
+
+/* Functions: myheap_lock, myheap_unlock
+ * --------------------------------------
+ * The one lock every thread-safe caller of the heap shares. The heap functions do not take it themselves.
+ */
+
+void myheap_lock(void)
+{
+    pthread_mutex_lock(&heap_lock);
+}
+
+void myheap_unlock(void)
+{
+    pthread_mutex_unlock(&heap_lock);
+}
+
+
 // validate_heap is your debugging routine to detect/report
 // on problems/inconsistency within your heap data structures
 bool validate_heap()
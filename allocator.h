@@ -2,12 +2,23 @@
  * -----------------
  * Interface file for the custom heap allocator.
  */
-#ifndef _ALLOCATOR_H
-#define _ALLOCATOR_H
+#ifndef _ALLOCATOR_H_
+#define _ALLOCATOR_H_
 
 #include <stdbool.h> // for bool
 #include <stddef.h>  // for size_t
 
+/* Constant: HEAP_ALIGNMENT
+ * ------------------------
+ * Every block returned by mymalloc and myrealloc is aligned to this many
+ * bytes: 8 by default, or 16 (max_align_t on x86-64, needed for aligned
+ * SSE loads of long double and __int128) when built with -DALIGN16.
+ */
+#ifdef ALIGN16
+#define HEAP_ALIGNMENT 16
+#else
+#define HEAP_ALIGNMENT 8
+#endif
 
 /* Function: myinit
  * ----------------
@@ -20,6 +31,27 @@
  */
 bool myinit(void);
 
+/* Function: myinit_pool
+ * ---------------------
+ * Alternative to myinit for real-time use. It configures a new empty heap
+ * backed by a fixed pool of the given number of bytes, committed and
+ * pre-faulted up front. After this, mymalloc, myrealloc and myfree never
+ * call into the kernel, and the time spent searching free lists is bounded.
+ * A request the pool cannot serve returns NULL. Returns true if the
+ * pool was set up, false otherwise. Calling myinit ends pool mode.
+ */
+bool myinit_pool(size_t bytes);
+
+/* Function: myatreset
+ * -------------------
+ * Registers fn to be called by myinit (and myinit_pool) before it resets
+ * the heap, for a module that holds memory outside the heap on behalf of
+ * heap objects, or pointers to heap objects outside the heap, which the
+ * reset discards. A function is registered once however often it is
+ * passed. Returns false if no more functions can be registered (up to 8).
+ */
+bool myatreset(void (*fn)(void));
+
 /* Function: mymalloc
  * ------------------
  * Custom version of malloc.
@@ -27,6 +59,72 @@ bool myinit(void);
 void *mymalloc(size_t size);
 
 
+/* Type: lifetime_t
+ * ----------------
+ * How long a block is expected to live, the hint given to mymalloc_hint.
+ * LIFETIME_SHORT: freed soon, e.g. within the request that allocated it.
+ * LIFETIME_LONG: lives a while, the default placement of mymalloc.
+ * LIFETIME_PERMANENT: rarely or never freed.
+ */
+typedef enum { LIFETIME_SHORT, LIFETIME_LONG, LIFETIME_PERMANENT } lifetime_t;
+
+/* Function: mymalloc_hint
+ * -----------------------
+ * Like mymalloc, with a hint of how long the block will live. Short-lived
+ * and permanent blocks are placed in regions of their own, away from the
+ * rest of the heap, so that the memory of short-lived blocks is reclaimed
+ * as a whole once they are gone. The block is freed with myfree (or
+ * myfree_sized) as usual; a wrong hint costs memory, never correctness.
+ */
+void *mymalloc_hint(size_t size, lifetime_t lifetime);
+
+
+/* Function: mymalloc_tagged
+ * -------------------------
+ * Like mymalloc, but blocks allocated with the same tag are placed next to
+ * each other, in allocation order, apart from the rest of the heap, so the
+ * objects of one data structure stay close for traversal. Tags are folded
+ * into 64 slots (tag % 64), and a tag's space is reused only once all the
+ * blocks around it are freed. Large requests are placed as by mymalloc.
+ * Blocks are freed with myfree as usual.
+ */
+void *mymalloc_tagged(size_t size, unsigned tag);
+
+
+/* Function: myset_lifetime_prediction
+ * -----------------------------------
+ * Turns automatic lifetime prediction on or off (it is off initially).
+ * While it is on, mymalloc learns from a sample of the blocks it hands
+ * out how long blocks from each call site (and size class) tend to live,
+ * and places those from sites whose blocks die young in short-lived regions
+ * as mymalloc_hint would. Each call resets what was learned, so does myinit
+ * (which keeps the setting).
+ */
+void myset_lifetime_prediction(bool enable);
+
+
+/* Function: mycalloc
+ * ------------------
+ * Custom version of calloc. Returns a zero-filled block for an array of
+ * nmemb elements of size bytes each, or NULL if nmemb*size overflows or the
+ * request cannot be served. Memory the heap has never handed out is already
+ * zero and is not cleared again.
+ */
+void *mycalloc(size_t nmemb, size_t size);
+
+
+/* Function: myaligned_alloc
+ * --------------------------
+ * Custom version of aligned_alloc. Returns a block of at least size bytes
+ * whose address is a multiple of align, which must be a power of 2 (for
+ * example 16, 64 for a cache line, or a page). Returns NULL if align is not a
+ * power of 2 or the request cannot be served. The block is released with
+ * myfree and can be resized with myrealloc, though a moved block only keeps
+ * the default alignment.
+ */
+void *myaligned_alloc(size_t align, size_t size);
+
+
 /* Function: myrealloc
  * -------------------
  * Custom version of realloc.
@@ -41,6 +139,102 @@ void *myrealloc(void *ptr, size_t size);
 void myfree(void *ptr);
 
 
+/* Function: mymalloc_at_least
+ * ---------------------------
+ * Like mymalloc, but also stores in *usable the number of bytes the caller
+ * may actually use, which is at least size (0 if NULL is returned). A
+ * growing buffer can fill that capacity before it needs myrealloc.
+ */
+void *mymalloc_at_least(size_t size, size_t *usable);
+
+
+/* Function: myusable_size
+ * -----------------------
+ * Returns the number of usable bytes in the block at ptr, at least the
+ * size it was last allocated or reallocated with. Includes slack such as
+ * the headroom myrealloc leaves and rounding to the alignment. Resizing
+ * within this size with myrealloc returns the same pointer. 0 for NULL.
+ */
+size_t myusable_size(void *ptr);
+
+
+/* Function: mytry_expand
+ * ----------------------
+ * Tries to grow the block at ptr in place, to preferred_size if it can and
+ * to at least min_size. On success returns the new usable size (at least
+ * min_size) and the block keeps its address and contents. Returns 0 if the
+ * block cannot grow to min_size without moving, in which case nothing is
+ * changed. Lets a container skip the copy myrealloc would make.
+ */
+size_t mytry_expand(void *ptr, size_t min_size, size_t preferred_size);
+
+
+/* Function: mymalloc_group
+ * ------------------------
+ * Allocates n objects of sizes[0..n-1] bytes together in one block and
+ * stores their addresses in out[0..n-1]. The objects are laid out in
+ * order, each at the first HEAP_ALIGNMENT boundary past the end of the one
+ * before it. Returns the block, which is out[0]; the objects are freed
+ * together by passing it to myfree, and individual objects must not be
+ * freed or reallocated. Returns NULL if n is 0, all sizes are 0 or the
+ * request cannot be served.
+ */
+void *mymalloc_group(const size_t sizes[], size_t n, void *out[]);
+
+
+/* Function: mymalloc_batch
+ * ------------------------
+ * Allocates n blocks of size bytes each, storing them in out[0..n-1].
+ * Cheaper than n calls to mymalloc since the bookkeeping and search are
+ * done once for the batch. Returns the number of blocks allocated, which is
+ * less than n only if the heap ran out; those blocks are still valid.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]);
+
+
+/* Function: myfree_batch
+ * ----------------------
+ * Frees the n blocks in ptrs[] as myfree would, skipping NULL entries.
+ * Freeing blocks in descending address order lets more of them go back
+ * to the end of the heap.
+ */
+void myfree_batch(void *ptrs[], size_t n);
+
+
+/* Function: myfree_sized
+ * ----------------------
+ * Frees ptr like myfree, given the size the block was allocated with (the
+ * size passed to mymalloc, myaligned_alloc or myrealloc, nmemb*size for
+ * mycalloc; a block myrealloc shrank in place keeps its earlier size). It
+ * costs the same as myfree: freeing writes the block header, which sits
+ * right before the payload, so the size does not save touching it. Build
+ * the allocator with -DCHECK_SIZED_FREE to verify size against the header
+ * on every call and abort on a mismatch.
+ */
+void myfree_sized(void *ptr, size_t size);
+
+
+/* Function: myreserve
+ * -------------------
+ * Warms up the heap before it takes traffic: makes sure at least bytes
+ * of fresh heap memory are set aside and pre-faulted, so that allocations
+ * served from it take no page faults and make no system calls.
+ * Returns true on success, false if the heap cannot be grown that far.
+ */
+bool myreserve(size_t bytes);
+
+
+/* Functions: myheap_lock, myheap_unlock
+ * --------------------------------------
+ * The heap is not thread safe. A program that calls it from several
+ * threads takes this one lock around every call; the modules on top of
+ * the heap that may be used from several threads (shared pools, deferred
+ * frees, libmyalloc.so) take it around theirs.
+ */
+void myheap_lock(void);
+void myheap_unlock(void);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
@@ -0,0 +1,237 @@
+/* File: allocator.hpp
+ * -------------------
+ * C++ adaptors for the heap allocator (C++17):
+ *
+ *   myalloc::heap_resource     a std::pmr::memory_resource on mymalloc/myfree,
+ *                              shared instance from heap_memory_resource()
+ *   myalloc::arena_resource    a std::pmr::memory_resource on an arena (arena.h)
+ *   myalloc::heap_allocator<T> a stateless allocator for the standard containers
+ *
+ * Alignments up to HEAP_ALIGNMENT are served by mymalloc, larger ones by
+ * myaligned_alloc. Blocks from mymalloc are given back with myfree_sized
+ * since the containers pass the size along (it costs what myfree does, and
+ * an allocator built with -DCHECK_SIZED_FREE checks the size), those from
+ * myaligned_alloc with myfree. The heap must have been set up with myinit,
+ * and it is not thread safe.
+ *
+ * Defining MYALLOC_REPLACE_NEW before including this header in exactly one
+ * source file of a program also replaces the global operator new and delete
+ * (plain, array, nothrow, sized and aligned forms) with the heap. They set
+ * the heap up on first use, so the program must not call myinit itself.
+ * Plain new asks for __STDCPP_DEFAULT_NEW_ALIGNMENT__ (16 on x86-64), so
+ * build with -DALIGN16 for it to take the mymalloc path rather than
+ * myaligned_alloc. For multithreaded programs, preload libmyalloc.so
+ * instead. "make bench-new" runs pmrbench this way.
+ */
+#ifndef _ALLOCATOR_HPP
+#define _ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+extern "C" {
+#include "allocator.h"
+#include "arena.h"
+}
+
+namespace myalloc {
+
+namespace detail {
+
+// Helper function to get bytes aligned to align from the heap, NULL if out of memory
+inline void *allocate(std::size_t bytes, std::size_t align) noexcept
+{
+    if (bytes == 0) bytes = 1;   // the heap returns NULL for 0 bytes
+    return align <= HEAP_ALIGNMENT ? mymalloc(bytes) : myaligned_alloc(align, bytes);
+}
+
+// Helper function to give back a block allocate(bytes, align) returned
+inline void deallocate(void *ptr, std::size_t bytes, std::size_t align) noexcept
+{
+    if (align > HEAP_ALIGNMENT)
+        myfree(ptr);
+    else
+        myfree_sized(ptr, bytes == 0 ? 1 : bytes);
+}
+
+} // namespace detail
+
+
+/* Class: heap_resource
+ * --------------------
+ * Memory resource that allocates from the heap. It holds no state, so any
+ * two heap_resources compare equal and may free each other's blocks.
+ */
+class heap_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        void *ptr = detail::allocate(bytes, align);
+        if (ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t align) override
+    {
+        detail::deallocate(ptr, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const heap_resource *>(&other) != nullptr;
+    }
+};
+
+/* Function: heap_memory_resource
+ * ------------------------------
+ * Returns the shared heap_resource, for example to pass to
+ * std::pmr::set_default_resource or to a pmr container.
+ */
+inline heap_resource *heap_memory_resource() noexcept
+{
+    static heap_resource resource;
+    return &resource;
+}
+
+
+/* Class: arena_resource
+ * ---------------------
+ * Memory resource that bump-allocates from an arena of its own. Deallocation
+ * does nothing; release() empties the arena at once and the destructor gives
+ * it back. Throws std::bad_alloc if the arena cannot be created.
+ */
+class arena_resource : public std::pmr::memory_resource {
+public:
+    explicit arena_resource(std::size_t chunksz = 0) : arena(arena_create(chunksz))
+    {
+        if (arena == nullptr) throw std::bad_alloc();
+    }
+    ~arena_resource() { arena_destroy(arena); }
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+
+    void release() noexcept { arena_reset(arena); }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        if (bytes == 0) bytes = 1;
+        std::size_t slack = align > HEAP_ALIGNMENT ? align - HEAP_ALIGNMENT : 0;
+        void *ptr = arena_alloc(arena, bytes + slack);
+        if (ptr == nullptr) throw std::bad_alloc();
+        return reinterpret_cast<void *>((reinterpret_cast<std::uintptr_t>(ptr) + align-1) & ~(std::uintptr_t)(align-1));
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    arena_t *arena;
+};
+
+
+/* Class: heap_allocator
+ * ---------------------
+ * Stateless allocator for the standard containers, e.g.
+ * std::vector<int, myalloc::heap_allocator<int>>. Objects are aligned to
+ * alignof(T) and freed with their size.
+ */
+template <class T>
+struct heap_allocator {
+    using value_type = T;
+
+    heap_allocator() noexcept = default;
+    template <class U> heap_allocator(const heap_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+        void *ptr = detail::allocate(n * sizeof(T), alignof(T));
+        if (ptr == nullptr) throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        detail::deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const heap_allocator<T> &, const heap_allocator<U> &) noexcept { return true; }
+
+template <class T, class U>
+bool operator!=(const heap_allocator<T> &, const heap_allocator<U> &) noexcept { return false; }
+
+} // namespace myalloc
+
+
+#ifdef MYALLOC_REPLACE_NEW
+
+extern "C" {
+#include "segment.h"
+}
+
+namespace myalloc {
+namespace detail {
+
+/* Helper function for operator new: sets the heap up on first use, then
+ * allocates, calling the new handler and retrying while the heap is out of
+ * memory. Throws std::bad_alloc when there is no handler.
+ */
+inline void *new_block(std::size_t size, std::size_t align)
+{
+    static const bool ready = heap_segment_start() != nullptr || myinit();
+    (void)ready;
+    for (;;) {
+        void *ptr = allocate(size, align);
+        if (ptr != nullptr) return ptr;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+
+inline void *new_block_nothrow(std::size_t size, std::size_t align) noexcept
+{
+    try {
+        return new_block(size, align);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+} // namespace detail
+} // namespace myalloc
+
+void *operator new(std::size_t size) { return myalloc::detail::new_block(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](std::size_t size) { return myalloc::detail::new_block(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return myalloc::detail::new_block_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return myalloc::detail::new_block_nothrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(std::size_t size, std::align_val_t align) { return myalloc::detail::new_block(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return myalloc::detail::new_block(size, static_cast<std::size_t>(align)); }
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return myalloc::detail::new_block_nothrow(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return myalloc::detail::new_block_nothrow(size, static_cast<std::size_t>(align)); }
+
+void operator delete(void *ptr) noexcept { myfree(ptr); }
+void operator delete[](void *ptr) noexcept { myfree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { myfree(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { myfree(ptr); }
+void operator delete(void *ptr, std::size_t size) noexcept { myalloc::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete[](void *ptr, std::size_t size) noexcept { myalloc::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete(void *ptr, std::align_val_t) noexcept { myfree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { myfree(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { myfree(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { myfree(ptr); }
+void operator delete(void *ptr, std::size_t size, std::align_val_t align) noexcept { myalloc::detail::deallocate(ptr, size, static_cast<std::size_t>(align)); }
+void operator delete[](void *ptr, std::size_t size, std::align_val_t align) noexcept { myalloc::detail::deallocate(ptr, size, static_cast<std::size_t>(align)); }
+
+#endif // MYALLOC_REPLACE_NEW
+
+#endif
@@ -18,7 +18,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <valgrind/callgrind.h>
 
@@ -26,8 +29,8 @@
 #include "fcyc.h"
 #include "segment.h"
 
-// Alignment requirement
-#define ALIGNMENT 8
+// Alignment requirement, as promised by the allocator interface
+#define ALIGNMENT HEAP_ALIGNMENT
 
 // Returns true if p is ALIGNMENT-byte aligned
 #define IS_ALIGNED(p)  ((((uintptr_t)p) % ALIGNMENT) == 0)
@@ -40,11 +43,20 @@
 // This constant is the stable target allocator throughput is ranked against
 #define TARGET_THRUPUT      12000
 
+// A block freed or reallocated within this many requests counts as short-lived for -L
+#define SHORT_LIFETIME 1000
+
+// Number of points at which utilization over time is sampled for -u
+#define UTIL_SAMPLES 10
+
 // struct for a single allocator request
 typedef struct {
-    enum {ALLOC=1, FREE, REALLOC} op;	// type of request
-    int id;		        // id for free() to use later
-    size_t size;        // num bytes for alloc/realloc request
+    enum {ALLOC=1, FREE, REALLOC, MEMALIGN, BATCH, FREE_BATCH, EXPAND, CALLOC, FREE_SIZED} op;	// type of request
+    int id;		        // id for free() to use later, first of count ids for batch requests
+    size_t size;        // num bytes for alloc/realloc/batch/calloc request, min size for expand request
+    size_t align;       // required alignment for memalign request, preferred size for expand request, element size for calloc request
+    size_t count;       // number of blocks (ids) for batch requests
+    lifetime_t lifetime; // observed lifetime of the block allocated, the hint used with -L
     int lineno;         // which line in file
 } request_t;
 
@@ -61,6 +73,7 @@ typedef struct {
     int num_ops;		// number of requests
     int num_ids;		// number of distinct block ids
     block_t *blocks;    // array of blocks returned by malloc when executing
+    void **batch;       // scratch array of num_ids pointers for batch requests
 } script_t;
 
 // packs the params to the speed function to be timed by fcyc.
@@ -68,6 +81,10 @@ typedef struct {
 typedef struct {
     script_t *script;
     double *utilization;
+    size_t *syscalls;
+    long long *dtlb_misses;
+    double *util_series;
+    size_t syscalls_before;   // segment syscalls before setup_performance started the allocator
 } perfdata_t;
 
 // Result from executing a script
@@ -78,18 +95,41 @@ typedef struct {
     double secs;		// number of secs needed to execute the script
     double utilization;	// mem utilization  (percent of heap storage in use)
     int tput;           // expressed in Kreq/sec
+    size_t syscalls;    // segment syscalls (mmap/mprotect/...) made while executing
+    long long dtlb_misses; // dTLB load misses while executing, -1 if not measured
+    double worst_cycles[4];  // worst-case cycles of a single malloc, free, realloc, memalign (indexed by op-1), batch, expand, calloc and sized free requests are not timed
+    double util_series[UTIL_SAMPLES];  // utilization (in use / segment size) at evenly spaced points of the script
 } result_t;
 
-typedef enum { Correctness = 1, Performance = 2 } flags_t;
+typedef enum { Correctness = 1, Performance = 2, Latency = 4, Timeline = 8 } flags_t;
+
+// size of the fixed pool for myinit_pool (-P), 0 to use myinit
+static size_t pool_bytes = 0;
+
+// allocate with mymalloc_hint, passing each block's observed lifetime (-L)
+static bool use_hints = false;
+
+// turn on the allocator's own lifetime prediction (-A)
+static bool predict_lifetimes = false;
+
+// perf counter for dTLB load misses, -1 if the counter is unavailable
+static int dtlb_fd = -1;
 
 static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount);
 static void parse_script(char *filename, script_t *script);
 static void run_scripts(char paths[][PATH_MAX], int n, flags_t flags);
 static bool eval_correctness(script_t *script);
+static void setup_performance(void *data);
 static void eval_performance(void *data);
+static void eval_latency(script_t *script, double worst[]);
+static bool init_allocator(void);
+static void *alloc_block(request_t *req);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
+static bool verify_alignment(void *ptr, size_t align, script_t *script, int lineno);
+static bool verify_zeroed(void *ptr, size_t size, script_t *script, int lineno);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
 static void print_table(result_t result[], int n, flags_t which);
+static int open_dtlb_counter(void);
 static void usage();
 static void fatal_error(char *format, ...);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
@@ -106,7 +146,7 @@ int main(int argc, char *argv[])
     int nscripts = 0;
 
     CALLGRIND_TOGGLE_COLLECT ;// turn off profiling while we do the setup work, later turn on during simulation
-    while ((c = getopt(argc, argv, "f:pc")) != EOF) {
+    while ((c = getopt(argc, argv, "f:pcHlP:LAu")) != EOF) {
         switch (c) {
             case 'f':
                 get_scripts(optarg, paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
@@ -117,6 +157,25 @@ int main(int argc, char *argv[])
             case 'c':
                 flags = Correctness;
                 break;
+            case 'H':
+                set_heap_segment_options(heap_segment_options() | SEGMENT_HUGEPAGES);
+                break;
+            case 'l':
+                flags |= Latency;
+                break;
+            case 'P':
+                pool_bytes = strtoul(optarg, NULL, 10) << 20;
+                if (pool_bytes == 0) usage();
+                break;
+            case 'L':
+                use_hints = true;
+                break;
+            case 'A':
+                predict_lifetimes = true;
+                break;
+            case 'u':
+                flags |= Timeline;
+                break;
             default:
                 usage();
         }
@@ -125,6 +184,7 @@ int main(int argc, char *argv[])
     if (nscripts == 0)
         get_scripts(DEFAULT_SCRIPT_DIR, paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
     qsort(paths, nscripts, sizeof(paths[0]), cmpbase); // sort by filename
+    dtlb_fd = open_dtlb_counter();
     setvbuf(stdout, NULL, _IONBF, 0); // disable stdout buffering, all printfs display to terminal immediately
     run_scripts(paths, nscripts, flags);
     return 0;
@@ -180,15 +240,22 @@ static void run_scripts(char paths[][PATH_MAX], int n, flags_t which)
         printf("Evaluating allocator on %s....", script.name);
         result[i].valid = !(which & Correctness) || eval_correctness(&script);
         if (result[i].valid && (which & Performance)) {
-            perfdata_t pd = {.script = &script, .utilization = &result[i].utilization};
+            perfdata_t pd = {.script = &script, .utilization = &result[i].utilization, .syscalls = &result[i].syscalls,
+                             .dtlb_misses = &result[i].dtlb_misses, .util_series = result[i].util_series};
+            set_fcyc_setup(setup_performance);
             result[i].secs = fsecs(eval_performance, &pd);
             result[i].tput = result[i].num_ops/(result[i].secs*1e3);
         } else {
             result[i].secs = result[i].utilization = 0;
+            result[i].syscalls = 0;
+            result[i].dtlb_misses = -1;
         }
+        if (result[i].valid && (which & Latency))
+            eval_latency(&script, result[i].worst_cycles);
         printf("done.\n");
         free(script.ops);
         free(script.blocks);
+        free(script.batch);
     }
     print_table(result, n, which); // display results
 }
@@ -242,25 +309,65 @@ static void parse_script(char *path, script_t *script)
         }
         script->ops[i].lineno = lineno;
         char request;
-        script->ops[i].op = script->ops[i].size = 0;
-        int nscanned = sscanf(buf, " %c %d %zu", &request, &script->ops[i].id, &script->ops[i].size);
+        script->ops[i].op = script->ops[i].size = script->ops[i].align = 0;
+        script->ops[i].count = 1;
+        int nscanned = sscanf(buf, " %c %d %zu %zu", &request, &script->ops[i].id, &script->ops[i].size, &script->ops[i].align);
+        size_t align = script->ops[i].align;
         if (request == 'a' && nscanned == 3)
             script->ops[i].op = ALLOC;
+        else if (request == 'm' && nscanned == 4 && align != 0 && (align & (align-1)) == 0)
+            script->ops[i].op = MEMALIGN;
         else if (request == 'r' && nscanned == 3)
             script->ops[i].op = REALLOC;
         else if (request == 'f' && nscanned == 2)
             script->ops[i].op = FREE;
-        if (!script->ops[i].op || script->ops[i].id < 0 || script->ops[i].size > INT_MAX)
+        else if (request == 's' && nscanned == 2)   // s id: myfree_sized with the size the block was given
+            script->ops[i].op = FREE_SIZED;
+        else if (request == 'b' && nscanned == 4) {   // b id count size
+            script->ops[i].op = BATCH;
+            script->ops[i].count = script->ops[i].size;
+            script->ops[i].size = align;
+        }
+        else if (request == 'F' && nscanned == 3) {   // F id count
+            script->ops[i].op = FREE_BATCH;
+            script->ops[i].count = script->ops[i].size;
+            script->ops[i].size = 0;
+        }
+        else if (request == 'e' && nscanned == 4)
+            script->ops[i].op = EXPAND;
+        else if (request == 'c' && nscanned == 4 && align != 0 && script->ops[i].size <= SIZE_MAX/2/align) {   // c id nmemb size
+            script->ops[i].op = CALLOC;
+            script->ops[i].size *= align;
+        }
+        if (!script->ops[i].op || script->ops[i].id < 0 || script->ops[i].size > SIZE_MAX/2 ||
+            script->ops[i].count == 0 || script->ops[i].count > INT_MAX - script->ops[i].id)
             fatal_error("Malformed request '%s' line %d of %s\n", buf, lineno, script->name);
-        if (script->ops[i].id > maxid) maxid = script->ops[i].id;
+        if (script->ops[i].id + (int)script->ops[i].count - 1 > maxid) maxid = script->ops[i].id + script->ops[i].count - 1;
         script->num_ops = i+1;
     }
     fclose(fp);
 
     script->num_ids = maxid + 1;
     script->blocks = calloc(script->num_ids, sizeof(block_t));
-    if (!script->blocks)
+    script->batch = malloc(script->num_ids*sizeof(void *));
+    if (!script->blocks || !script->batch)
+        fatal_error("Libc heap exhausted. Cannot continue.\n");
+
+    // Derive each block's lifetime from the next request on its id, walking the script backwards
+    int *next_use = malloc(script->num_ids*sizeof(int));
+    if (!next_use)
         fatal_error("Libc heap exhausted. Cannot continue.\n");
+    for (int id = 0; id < script->num_ids; id++) next_use[id] = -1;
+    for (int i = script->num_ops-1; i >= 0; i--) {
+        int id = script->ops[i].id;
+        if (next_use[id] < 0)
+            script->ops[i].lifetime = LIFETIME_PERMANENT;
+        else
+            script->ops[i].lifetime = (next_use[id] - i < SHORT_LIFETIME) ? LIFETIME_SHORT : LIFETIME_LONG;
+        for (size_t k = 0; k < script->ops[i].count; k++)   // hints are only used for single allocs
+            next_use[id + k] = i;
+    }
+    free(next_use);
 }
 
 
@@ -272,8 +379,8 @@ static void parse_script(char *path, script_t *script)
  */
 static bool eval_correctness(script_t *script)
 {
-    if (!myinit()) {
-        allocator_error(script, 0, "myinit() returned false");
+    if (!init_allocator()) {
+        allocator_error(script, 0, "%s() returned false", pool_bytes ? "myinit_pool" : "myinit");
         return false;
     }
     if (!validate_heap()) { // check heap consistency after init
@@ -285,13 +392,13 @@ static bool eval_correctness(script_t *script)
     for (int req = 0; req < script->num_ops; req++) {
         int id = script->ops[req].id;
         size_t requested_size = script->ops[req].size;
-        size_t old_size = script->blocks[id].size;
+        size_t old_size = script->blocks[id].size, count;
         void *p, *newp, *oldp = script->blocks[id].ptr;
 
         switch (script->ops[req].op) {
 
             case ALLOC:
-                if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
+                if ((p = alloc_block(&script->ops[req])) == NULL && requested_size != 0) {
                     allocator_error(script, script->ops[req].lineno, "malloc returned NULL");
                     return false;
                 }
@@ -306,6 +413,19 @@ static bool eval_correctness(script_t *script)
                 script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
                 break;
 
+            case MEMALIGN:
+                if ((p = myaligned_alloc(script->ops[req].align, requested_size)) == NULL && requested_size != 0) {
+                    allocator_error(script, script->ops[req].lineno, "aligned_alloc returned NULL");
+                    return false;
+                }
+                // Same checks as for malloc, plus the requested alignment
+                if (!verify_alignment(p, script->ops[req].align, script, script->ops[req].lineno) ||
+                    !verify_block(p, requested_size, script, script->ops[req].lineno))
+                    return false;
+                memset(p, id & 0xFF, requested_size);
+                script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+                break;
+
             case REALLOC:
                 if (!verify_payload(oldp, old_size, id, script, script->ops[req].lineno, "realloc-ing"))
                     return false;
@@ -339,6 +459,70 @@ static bool eval_correctness(script_t *script)
                 script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
                 myfree(p);
                 break;
+
+            case FREE_SIZED:
+                if (!verify_payload(oldp, old_size, id, script, script->ops[req].lineno, "sized freeing"))
+                    return false;
+                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+                myfree_sized(oldp, old_size);
+                break;
+
+            case BATCH:
+                if ((count = mymalloc_batch(requested_size, script->ops[req].count, script->batch)) != script->ops[req].count) {
+                    allocator_error(script, script->ops[req].lineno, "malloc_batch returned %zu of %zu blocks", count, script->ops[req].count);
+                    return false;
+                }
+                // Each block gets the checks of a malloc'ed one, in turn, and the fill of its own id
+                for (size_t k = 0; k < count; k++) {
+                    p = script->batch[k];
+                    if (!verify_block(p, requested_size, script, script->ops[req].lineno))
+                        return false;
+                    memset(p, (id + k) & 0xFF, requested_size);
+                    script->blocks[id + k] = (block_t){.ptr = p, .size = requested_size};
+                }
+                break;
+
+            case FREE_BATCH:
+                for (size_t k = 0; k < script->ops[req].count; k++) {
+                    block_t *b = &script->blocks[id + k];
+                    if (!verify_payload(b->ptr, b->size, id + k, script, script->ops[req].lineno, "batch freeing"))
+                        return false;
+                    script->batch[k] = b->ptr;
+                    *b = (block_t){.ptr = NULL, .size = 0};
+                }
+                myfree_batch(script->batch, script->ops[req].count);
+                break;
+
+            case EXPAND:
+                if (!verify_payload(oldp, old_size, id, script, script->ops[req].lineno, "expanding"))
+                    return false;
+                if ((count = mytry_expand(oldp, requested_size, script->ops[req].align)) == 0)
+                    break;   // could not grow in place, the block is unchanged
+                if (count < requested_size || myusable_size(oldp) < count) {
+                    allocator_error(script, script->ops[req].lineno, "try_expand returned %zu for a minimum of %zu (usable size %zu)",
+                                    count, requested_size, myusable_size(oldp));
+                    return false;
+                }
+                // The grown block must not run into any other block
+                script->blocks[id].size = 0;
+                if (!verify_block(oldp, requested_size, script, script->ops[req].lineno))
+                    return false;
+                memset(oldp, id & 0xFF, requested_size);
+                script->blocks[id] = (block_t){.ptr = oldp, .size = requested_size};
+                break;
+
+            case CALLOC:
+                if ((p = mycalloc(requested_size / script->ops[req].align, script->ops[req].align)) == NULL && requested_size != 0) {
+                    allocator_error(script, script->ops[req].lineno, "calloc returned NULL");
+                    return false;
+                }
+                // Same checks as for malloc, plus the block must read back as zero
+                if (!verify_block(p, requested_size, script, script->ops[req].lineno) ||
+                    !verify_zeroed(p, requested_size, script, script->ops[req].lineno))
+                    return false;
+                memset(p, id & 0xFF, requested_size);
+                script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+                break;
         }
 
         if (!validate_heap()) { // check heap consistency after each request
@@ -355,25 +539,46 @@ static bool eval_correctness(script_t *script)
 }
 
 
+/* Function: setup_performance
+ * ---------------------------
+ * Starts the allocator on a fresh heap for the next run of eval_performance.
+ * fsecs calls it before each run, outside the timed part, so that setting
+ * up a pool (-P), which commits and pre-faults all of it, is not counted
+ * as time spent serving the requests.
+ */
+static void setup_performance(void *data)
+{
+    perfdata_t *pd = (perfdata_t *)data;
+    pd->syscalls_before = heap_segment_syscalls();
+    init_allocator();
+    memset(pd->script->blocks, 0, pd->script->num_ids*sizeof(pd->script->blocks[0]));
+}
+
+
 /* Function: eval_performance
  * --------------------------
  * This is almost same code as function above, but unifying the two clutters
  * the code path adds performance penalties to the time trial, which needed to
  * be avoided. This interprets the script with no additional overhead
  * (e.g. no checking for validity), measures time, and tracks the high water mark
- * of the heap segment to report on memory utilization.  The function
+ * of the heap segment to report on memory utilization. It also counts the
+ * memory-management syscalls made by the segment layer during the run
+ * (including the ones made by myinit in setup_performance) and, if the perf counter is available,
+ * the dTLB load misses of the request loop.  The function
  * takes a void* client pointer, since that is what is required to work
  * with the timing trial code. This client data provides the script to exeucute.
  */
 static void eval_performance(void *data)
 {
     perfdata_t *pd = (perfdata_t *)data;
-    size_t peak_payload_size = 0, cur_payload_size = 0, max_segment_size = 0;
+    size_t peak_payload_size = 0, cur_payload_size = 0, max_segment_size = 0, count;
     script_t *script = pd->script;
+    int sample = 0, sample_every = script->num_ops/UTIL_SAMPLES, next_sample = sample_every - 1;
 
-    myinit();
-    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
-
+    if (dtlb_fd >= 0) {
+        ioctl(dtlb_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
     CALLGRIND_TOGGLE_COLLECT;	// turn on valgrind profiler here
     for (int line = 0; line < script->num_ops;  line++) {
         int id = script->ops[line].id;
@@ -382,7 +587,14 @@ static void eval_performance(void *data)
         switch (script->ops[line].op) {
 
             case ALLOC:
-                script->blocks[id].ptr = mymalloc(requested_size);
+                script->blocks[id].ptr = alloc_block(&script->ops[line]);
+                script->blocks[id].size = requested_size;
+                cur_payload_size += requested_size;
+                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
+                break;
+
+            case MEMALIGN:
+                script->blocks[id].ptr = myaligned_alloc(script->ops[line].align, requested_size);
                 script->blocks[id].size = requested_size;
                 cur_payload_size += requested_size;
                 if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
@@ -400,6 +612,44 @@ static void eval_performance(void *data)
                 cur_payload_size -= script->blocks[id].size;
                 script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
                 break;
+
+            case FREE_SIZED:
+                myfree_sized(script->blocks[id].ptr, script->blocks[id].size);
+                cur_payload_size -= script->blocks[id].size;
+                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+                break;
+
+            case BATCH:
+                count = mymalloc_batch(requested_size, script->ops[line].count, script->batch);
+                for (size_t k = 0; k < count; k++) {
+                    script->blocks[id + k] = (block_t){.ptr = script->batch[k], .size = requested_size};
+                    ((char *)script->batch[k])[0] = ((char *)script->batch[k])[requested_size-1] = 0xab;
+                }
+                cur_payload_size += count*requested_size;
+                break;
+
+            case FREE_BATCH:
+                for (size_t k = 0; k < script->ops[line].count; k++) {
+                    script->batch[k] = script->blocks[id + k].ptr;
+                    cur_payload_size -= script->blocks[id + k].size;
+                    script->blocks[id + k] = (block_t){.ptr = NULL, .size = 0};
+                }
+                myfree_batch(script->batch, script->ops[line].count);
+                break;
+
+            case EXPAND:
+                if (mytry_expand(script->blocks[id].ptr, requested_size, script->ops[line].align) == 0) break;
+                cur_payload_size += (requested_size - script->blocks[id].size);
+                script->blocks[id].size = requested_size;
+                if (requested_size) ((char *)script->blocks[id].ptr)[requested_size-1] = 0xcd;
+                break;
+
+            case CALLOC:
+                script->blocks[id].ptr = mycalloc(requested_size / script->ops[line].align, script->ops[line].align);
+                script->blocks[id].size = requested_size;
+                cur_payload_size += requested_size;
+                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
+                break;
         }
 
         // peak util is ratio of inuse/segment, reset when either changes (numerator or denom)
@@ -407,14 +657,131 @@ static void eval_performance(void *data)
             max_segment_size = heap_segment_size();
             peak_payload_size = cur_payload_size;
         } 
+        if (line == next_sample) {
+            pd->util_series[sample++] = (double)cur_payload_size/heap_segment_size();
+            next_sample = (sample < UTIL_SAMPLES) ? next_sample + sample_every : -1;
+        }
      }
  
     *pd->utilization = ((double)peak_payload_size)/max_segment_size;
+    *pd->syscalls = heap_segment_syscalls() - pd->syscalls_before;
+    *pd->dtlb_misses = -1;
+    if (dtlb_fd >= 0) {
+        ioctl(dtlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long misses;
+        if (read(dtlb_fd, &misses, sizeof(misses)) == sizeof(misses)) *pd->dtlb_misses = misses;
+    }
     CALLGRIND_TOGGLE_COLLECT;  // turn off profiler here
 }
 
 
 
+/* Function: eval_latency
+ * -----------------------
+ * Runs the script once more, timing every request on its own with the cycle
+ * counter, and records the worst-case cycles seen for each kind of request
+ * (malloc, free, realloc, memalign); batch, expand, calloc and sized free
+ * requests are run but not recorded. Kept apart from eval_performance because reading
+ * the counter around each request would distort the throughput figure.
+ */
+static void eval_latency(script_t *script, double worst[])
+{
+    init_allocator();
+    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
+    for (int op = 0; op < 4; op++) worst[op] = 0;
+
+    for (int line = 0; line < script->num_ops;  line++) {
+        int id = script->ops[line].id;
+        size_t requested_size = script->ops[line].size;
+        double cycles;
+
+        start_counter();
+        switch (script->ops[line].op) {
+            case ALLOC:
+                script->blocks[id].ptr = alloc_block(&script->ops[line]);
+                break;
+            case MEMALIGN:
+                script->blocks[id].ptr = myaligned_alloc(script->ops[line].align, requested_size);
+                break;
+            case REALLOC:
+                script->blocks[id].ptr = myrealloc(script->blocks[id].ptr, requested_size);
+                break;
+            case FREE:
+                myfree(script->blocks[id].ptr);
+                script->blocks[id].ptr = NULL;
+                break;
+            case BATCH:
+                mymalloc_batch(requested_size, script->ops[line].count, script->batch);
+                for (size_t k = 0; k < script->ops[line].count; k++)
+                    script->blocks[id + k].ptr = script->batch[k];
+                break;
+            case FREE_BATCH:
+                for (size_t k = 0; k < script->ops[line].count; k++) {
+                    script->batch[k] = script->blocks[id + k].ptr;
+                    script->blocks[id + k].ptr = NULL;
+                }
+                myfree_batch(script->batch, script->ops[line].count);
+                break;
+            case EXPAND:
+                mytry_expand(script->blocks[id].ptr, requested_size, script->ops[line].align);
+                break;
+            case CALLOC:
+                script->blocks[id].ptr = mycalloc(requested_size / script->ops[line].align, script->ops[line].align);
+                break;
+            case FREE_SIZED:   // sizes are not tracked here, the usable size is a valid one to pass
+                myfree_sized(script->blocks[id].ptr, myusable_size(script->blocks[id].ptr));
+                script->blocks[id].ptr = NULL;
+                break;
+        }
+        cycles = get_counter();
+        if (script->ops[line].op <= MEMALIGN && cycles > worst[script->ops[line].op - 1]) worst[script->ops[line].op - 1] = cycles;
+    }
+}
+
+
+/* Function: alloc_block
+ * ---------------------
+ * Allocates the block of an alloc request, with mymalloc_hint and the block's
+ * observed lifetime if -L was given.
+ */
+static void *alloc_block(request_t *req)
+{
+    return use_hints ? mymalloc_hint(req->size, req->lifetime) : mymalloc(req->size);
+}
+
+
+/* Function: init_allocator
+ * ------------------------
+ * Starts the allocator on a fresh heap, in pool mode if -P was given and with
+ * lifetime prediction if -A was given.
+ */
+static bool init_allocator(void)
+{
+    myset_lifetime_prediction(predict_lifetimes);
+    return pool_bytes ? myinit_pool(pool_bytes) : myinit();
+}
+
+
+/* Function: open_dtlb_counter
+ * ----------------------------
+ * Opens a hardware counter for dTLB load misses of this process (user space
+ * only), initially disabled. Returns the counter fd, or -1 if perf events are
+ * not available (e.g. in a VM or with perf_event_paranoid set too high).
+ */
+static int open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
 /* Function: verify_block
  * ----------------------
  * Does some simple checks on the block returned by allocator to try to
@@ -442,6 +809,13 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno)
                         ptr, end, heap_segment_start(), heap_end);
         return false;
     }
+    // usable size reported for the block must cover the request
+    if (myusable_size(ptr) < size) {
+        allocator_error(script, lineno, "New block (%p) has usable size %zu, less than the %zu requested",
+                        ptr, myusable_size(ptr), size);
+        return false;
+    }
+
     // block must not overlap any other blocks
     for (int i = 0; i < script->num_ids; i++) {
         if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) continue;
@@ -458,6 +832,38 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno)
 }
 
 
+/* Function: verify_alignment
+ * ---------------------------
+ * Checks that a block returned for a memalign request is aligned to the
+ * requested boundary, reporting an allocator error if not.
+ */
+static bool verify_alignment(void *ptr, size_t align, script_t *script, int lineno)
+{
+    if (((uintptr_t)ptr % align) != 0) {
+        allocator_error(script, lineno, "New block (%p) not aligned to requested %zu bytes", ptr, align);
+        return false;
+    }
+    return true;
+}
+
+
+/* Function: verify_zeroed
+ * ------------------------
+ * Checks that a block returned for a calloc request reads back as all zero,
+ * reporting an allocator error at the first byte that does not.
+ */
+static bool verify_zeroed(void *ptr, size_t size, script_t *script, int lineno)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (*((unsigned char *)ptr + i) != 0) {
+            allocator_error(script, lineno, "calloc'ed block (%p) not zeroed at byte %zu of %zu", ptr, i, size);
+            return false;
+        }
+    }
+    return true;
+}
+
+
 /* Function: verify_payload
  * ------------------------
  * When a block is allocated, the payload is filled with a simple repeating pattern
@@ -483,9 +889,13 @@ static void print_result(result_t *st, flags_t which, bool is_total)
 {
     printf("%-20s %-7s ", st->name, !is_total && (which & Correctness) ? (st->valid ? "Y" : "N") : "" );
     if (st->valid && (which & Performance))
-        printf("%7.0f%% %12d %14.6f %10d", st->utilization*100, st->num_ops, st->secs, st->tput);
+        printf("%7.0f%% %12d %14.6f %10d %10zu", st->utilization*100, st->num_ops, st->secs, st->tput, st->syscalls);
     else
-        printf("%7s %12s %14s %10s","-","-","-","-");
+        printf("%7s %12s %14s %10s %10s","-","-","-","-","-");
+    if (st->valid && (which & Performance) && st->dtlb_misses >= 0)
+        printf(" %12lld", st->dtlb_misses);
+    else
+        printf(" %12s", "-");
     printf("\n");
 }
 
@@ -497,12 +907,13 @@ static void print_result(result_t *st, flags_t which, bool is_total)
  */
 static void print_table(result_t result[], int n, flags_t which)
 {
-    char *dashes = "-------------------------------------------------------------------------------";
-    result_t total = {.name = "Aggregate", .valid = true, .num_ops = 0, .secs = 0, .utilization = 0};
+    char *dashes = "-------------------------------------------------------------------------------------------------------";
+    result_t total = {.name = "Aggregate", .valid = true, .num_ops = 0, .secs = 0, .utilization = 0, .syscalls = 0,
+                      .dtlb_misses = dtlb_fd >= 0 ? 0 : -1};
     int failures = 0;
 
     // Print the individual results for each script
-    printf("\n script name     correct?    utilization    requests       secs       Kreq/sec\n%s\n", dashes);
+    printf("\n script name     correct?    utilization    requests       secs       Kreq/sec   syscalls    dTLB-miss\n%s\n", dashes);
     for (int i = 0; i < n; i++) {
         print_result(&result[i], which, false);
         if (!result[i].valid)
@@ -512,6 +923,8 @@ static void print_table(result_t result[], int n, flags_t which)
             total.num_ops += result[i].num_ops;
             total.utilization += result[i].utilization;
             total.tput += result[i].tput;
+            total.syscalls += result[i].syscalls;
+            if (total.dtlb_misses >= 0 && result[i].dtlb_misses >= 0) total.dtlb_misses += result[i].dtlb_misses;
         }
     }
     printf("%s\n\n", dashes);
@@ -528,6 +941,36 @@ static void print_table(result_t result[], int n, flags_t which)
     if (failures != 0)
         printf("%d script%s exited with correctness errors.\n", failures, (failures > 1 ? "s" : ""));
     printf("\n");
+
+    // Print the worst-case cycles of a single request for each script
+    if (which & Latency) {
+        printf(" script name        worst malloc    worst free   worst realloc  worst memalign   (cycles)\n%s\n", dashes);
+        for (int i = 0; i < n; i++) {
+            if (result[i].valid)
+                printf("%-20s %12.0f %13.0f %15.0f %15.0f\n", result[i].name,
+                       result[i].worst_cycles[ALLOC-1], result[i].worst_cycles[FREE-1], result[i].worst_cycles[REALLOC-1],
+                       result[i].worst_cycles[MEMALIGN-1]);
+            else
+                printf("%-20s %12s %13s %15s %15s\n", result[i].name, "-", "-", "-", "-");
+        }
+        printf("%s\n\n", dashes);
+    }
+
+    // Print utilization at evenly spaced points through each script
+    if (which & Timeline) {
+        printf(" script name        utilization over time (in use / segment size, %d points)\n%s\n", UTIL_SAMPLES, dashes);
+        for (int i = 0; i < n; i++) {
+            printf("%-20s", result[i].name);
+            for (int k = 0; k < UTIL_SAMPLES; k++) {
+                if (result[i].valid && (which & Performance) && result[i].num_ops >= UTIL_SAMPLES)
+                    printf(" %6.0f%%", result[i].util_series[k]*100);
+                else
+                    printf(" %7s", "-");
+            }
+            printf("\n");
+        }
+        printf("%s\n\n", dashes);
+    }
 }
 
 // minor path/string handling helpers
@@ -566,6 +1009,12 @@ static void usage()
    fprintf(stderr, "\t-c                Run only the correctness tests (no checks for performance).\n");
    fprintf(stderr, "\t-p                Run only the performance tests (no checks for correctness).\n");
    fprintf(stderr, "\t-f <file-or-dir>  Use <file> as script or read all script files from <dir>.\n");
+   fprintf(stderr, "\t-H                Back the heap segment with transparent huge pages.\n");
+   fprintf(stderr, "\t-l                Also report worst-case cycles of a single request.\n");
+   fprintf(stderr, "\t-P <MB>           Run the allocator in pool mode with a fixed pool of <MB> megabytes.\n");
+   fprintf(stderr, "\t-L                Allocate with mymalloc_hint, hinting each block's observed lifetime.\n");
+   fprintf(stderr, "\t-A                Turn on the allocator's lifetime prediction by call site.\n");
+   fprintf(stderr, "\t-u                Also report utilization at %d points through each script.\n", UTIL_SAMPLES);
    fprintf(stderr, "Without -f option, reads scripts from default path: %s\n", DEFAULT_SCRIPT_DIR);
    exit(107);
 }
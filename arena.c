@@ -0,0 +1,148 @@
+/*
+ * File: arena.c
+ * -------------
+ * Arenas on top of the heap allocator and the segment's chunk layer.
+ *
+ * An arena is a list of chunks, newest first. Objects are carved from the
+ * newest chunk by bumping a pointer; when it is full a new chunk is added.
+ * Each chunk starts with a small header linking it to the one before it
+ * and recording where it came from: normal chunks are blocks of the main
+ * heap (mymalloc), chunks of CHUNK_SIZE or more are mapped on their own
+ * (chunk_alloc) so they go straight back to the OS on release.
+ * arena_reset drops all chunks but the oldest and rewinds the bump pointer,
+ * its cost depends on the number of chunks, not on the number of objects.
+ *
+ * Mapped chunks are also kept on one list across all arenas. myinit
+ * discards the arenas along with the rest of the heap, but not the chunks
+ * mapped outside it, so a reset hook (myatreset) releases every chunk
+ * still on that list.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "allocator.h"
+#include "arena.h"
+#include "segment.h"
+
+// header at the start of every arena chunk, padded so objects after it stay aligned
+typedef struct arena_chunk {
+    struct arena_chunk *prev;   // chunk added to the arena before this one, NULL for the oldest
+    size_t size;                // bytes in the chunk, header included
+    bool mapped;                // from chunk_alloc rather than mymalloc
+    struct arena_chunk *mapped_prev, *mapped_next;   // neighbours on the list of mapped chunks, mapped chunks only
+} arena_chunkT;
+
+#define CHUNK_HDR_SZ ((sizeof(arena_chunkT) + HEAP_ALIGNMENT-1) & ~(size_t)(HEAP_ALIGNMENT-1))
+
+struct arena {
+    arena_chunkT *chunks; // newest chunk, objects are carved from it
+    char *bump;           // next free byte in the newest chunk
+    char *limit;          // end of the newest chunk
+    size_t chunksz;       // size of a regular chunk
+};
+
+static arena_chunkT *mapped_chunks = NULL;   // live mapped chunks of all arenas
+static bool hook_set = false;                // release_mapped_chunks is registered with myatreset
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+// Reset hook: gives back the mapped chunks of the arenas myinit is about to discard
+static void release_mapped_chunks(void)
+{
+    while (mapped_chunks != NULL) {
+        arena_chunkT *next = mapped_chunks->mapped_next;
+        chunk_release(mapped_chunks);
+        mapped_chunks = next;
+    }
+}
+
+// Helper function to get a chunk of size bytes from the heap or, if that large, from the chunk layer
+static arena_chunkT *new_chunk(size_t size)
+{
+    bool mapped = size >= CHUNK_SIZE;
+    if (mapped && !hook_set && !(hook_set = myatreset(release_mapped_chunks))) return NULL;
+    arena_chunkT *chunk = mapped ? chunk_alloc(size) : mymalloc(size);
+    if (chunk == NULL) return NULL;
+    chunk->size = mapped ? roundup(size, CHUNK_SIZE) : myusable_size(chunk);   // use the slack too
+    chunk->mapped = mapped;
+    if (mapped) {
+        chunk->mapped_prev = NULL;
+        chunk->mapped_next = mapped_chunks;
+        if (mapped_chunks != NULL) mapped_chunks->mapped_prev = chunk;
+        mapped_chunks = chunk;
+    }
+    return chunk;
+}
+
+// Helper function to give a chunk back to where it came from
+static void release_chunk(arena_chunkT *chunk)
+{
+    if (!chunk->mapped) {
+        myfree(chunk);
+        return;
+    }
+    if (chunk->mapped_prev != NULL)
+        chunk->mapped_prev->mapped_next = chunk->mapped_next;
+    else
+        mapped_chunks = chunk->mapped_next;
+    if (chunk->mapped_next != NULL) chunk->mapped_next->mapped_prev = chunk->mapped_prev;
+    chunk_release(chunk);
+}
+
+arena_t *arena_create(size_t chunksz)
+{
+    if (chunksz == 0) chunksz = ARENA_CHUNK_SIZE;
+    if (chunksz < CHUNK_HDR_SZ + HEAP_ALIGNMENT || chunksz > MAX_SEGMENT_RESERVE) return NULL;
+    arena_t *arena = mymalloc(sizeof(arena_t));
+    if (arena == NULL) return NULL;
+    arena->chunks = NULL;
+    arena->bump = arena->limit = NULL;
+    arena->chunksz = chunksz;
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    if (size == 0 || size > MAX_SEGMENT_RESERVE) return NULL;
+    size = roundup(size, HEAP_ALIGNMENT);
+    if ((size_t)(arena->limit - arena->bump) >= size) {   // the common case
+        void *ptr = arena->bump;
+        arena->bump += size;
+        return ptr;
+    }
+
+    /* Start a new chunk, big enough for the request */
+    size_t need = size + CHUNK_HDR_SZ;
+    arena_chunkT *chunk = new_chunk(need > arena->chunksz ? need : arena->chunksz);
+    if (chunk == NULL) return NULL;
+    chunk->prev = arena->chunks;
+    arena->chunks = chunk;
+    arena->bump = (char *)chunk + CHUNK_HDR_SZ + size;
+    arena->limit = (char *)chunk + chunk->size;
+    return (char *)chunk + CHUNK_HDR_SZ;
+}
+
+void arena_reset(arena_t *arena)
+{
+    arena_chunkT *chunk = arena->chunks;
+    if (chunk == NULL) return;
+    while (chunk->prev != NULL) {
+        arena_chunkT *prev = chunk->prev;
+        release_chunk(chunk);
+        chunk = prev;
+    }
+    arena->chunks = chunk;
+    arena->bump = (char *)chunk + CHUNK_HDR_SZ;
+    arena->limit = (char *)chunk + chunk->size;
+}
+
+void arena_destroy(arena_t *arena)
+{
+    if (arena == NULL) return;
+    arena_reset(arena);
+    if (arena->chunks != NULL) release_chunk(arena->chunks);
+    myfree(arena);
+}
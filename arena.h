@@ -0,0 +1,55 @@
+/* File: arena.h
+ * -------------
+ * Interface for arenas (regions): objects are allocated from an arena by
+ * bumping a pointer and are never freed one by one. Instead the whole arena
+ * is emptied with arena_reset or given back with arena_destroy, so a batch
+ * of objects that die together (e.g. everything allocated for one request)
+ * is released in one call.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>  // for size_t
+
+/* Constant: ARENA_CHUNK_SIZE
+ * --------------------------
+ * Default size of the chunks an arena hands out objects from. Chunks below
+ * CHUNK_SIZE (see segment.h) are allocated from the main heap with mymalloc,
+ * larger ones are page runs of their own from the chunk layer.
+ */
+#define ARENA_CHUNK_SIZE (1L << 16)   // 64 KB
+
+typedef struct arena arena_t;
+
+/* Function: arena_create
+ * ----------------------
+ * Creates an empty arena that gets memory in chunks of chunksz bytes
+ * (ARENA_CHUNK_SIZE if 0). Returns NULL if it cannot be allocated.
+ * Arenas live on the main heap, so myinit discards them all, and gives
+ * back the chunks they had mapped of their own.
+ */
+arena_t *arena_create(size_t chunksz);
+
+/* Function: arena_alloc
+ * ---------------------
+ * Returns size bytes from the arena, aligned to HEAP_ALIGNMENT, or NULL if
+ * size is 0 or no memory is left. A request larger than the chunk size gets
+ * a chunk of its own. The memory stays valid until the next arena_reset or
+ * arena_destroy on this arena.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/* Function: arena_reset
+ * ---------------------
+ * Releases every object allocated from the arena at once. The first chunk
+ * is kept for reuse, any others are given back.
+ */
+void arena_reset(arena_t *arena);
+
+/* Function: arena_destroy
+ * -----------------------
+ * Releases the arena and all of its memory. NULL is ignored.
+ */
+void arena_destroy(arena_t *arena);
+
+#endif
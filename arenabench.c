@@ -0,0 +1,98 @@
+/*
+ * File: arenabench.c
+ * ------------------
+ * Compares two ways of releasing the objects of a request that all die
+ * together: freeing each one with myfree, or allocating them from an arena
+ * and releasing them with one arena_reset. Each simulated request allocates
+ * a number of small objects of varying size and writes to them; the cycles
+ * per request and per object of both paths are printed side by side.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "fcyc.h"
+
+#define MAX_OBJECTS 100000
+
+static int nrequests = 1000;         // requests simulated per path (-r)
+static int nobjects = 500;            // objects allocated per request (-n)
+static size_t sizes[MAX_OBJECTS];     // object sizes, the same for both paths
+static void *objects[MAX_OBJECTS];
+
+static void usage(void);
+
+// Allocates the objects of one request with mymalloc and frees them one by one
+static void heap_request(void)
+{
+    for (int i = 0; i < nobjects; i++) {
+        objects[i] = mymalloc(sizes[i]);
+        memset(objects[i], i, sizes[i]);
+    }
+    for (int i = 0; i < nobjects; i++)
+        myfree(objects[i]);
+}
+
+// Allocates the objects of one request from the arena and releases them with one reset
+static void arena_request(arena_t *arena)
+{
+    for (int i = 0; i < nobjects; i++) {
+        objects[i] = arena_alloc(arena, sizes[i]);
+        memset(objects[i], i, sizes[i]);
+    }
+    arena_reset(arena);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "r:n:")) != EOF) {
+        switch (c) {
+            case 'r':
+                nrequests = atoi(optarg);
+                break;
+            case 'n':
+                nobjects = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nrequests <= 0 || nobjects <= 0 || nobjects > MAX_OBJECTS) usage();
+
+    srand(107);
+    for (int i = 0; i < nobjects; i++)
+        sizes[i] = 16 + rand() % 241;   // 16 to 256 bytes
+
+    myinit();
+    start_counter();
+    for (int r = 0; r < nrequests; r++)
+        heap_request();
+    double heap_cycles = get_counter();
+
+    myinit();
+    arena_t *arena = arena_create(0);
+    start_counter();
+    for (int r = 0; r < nrequests; r++)
+        arena_request(arena);
+    double arena_cycles = get_counter();
+    arena_destroy(arena);
+
+    printf("%d requests of %d objects\n", nrequests, nobjects);
+    printf("%-22s %16s %16s\n", "path", "cycles/request", "cycles/object");
+    printf("%-22s %16.0f %16.1f\n", "mymalloc + myfree", heap_cycles/nrequests, heap_cycles/nrequests/nobjects);
+    printf("%-22s %16.0f %16.1f\n", "arena + arena_reset", arena_cycles/nrequests, arena_cycles/nrequests/nobjects);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: arenabench [-r <requests>] [-n <objects per request>]\n");
+    fprintf(stderr, "\t-r <requests>  Number of requests simulated per path (default 1000).\n");
+    fprintf(stderr, "\t-n <objects>   Objects allocated per request, at most %d (default 500).\n", MAX_OBJECTS);
+    exit(107);
+}
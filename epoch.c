@@ -0,0 +1,249 @@
+/*
+ * File: epoch.c
+ * -------------
+ * Epoch-based reclamation on top of the heap allocator.
+ *
+ * A global epoch counter only moves forward, and only from e to e+1 once
+ * every thread inside a read-side section has observed e. Each registered
+ * thread has a record holding the epoch it observed on entering its
+ * outermost section (or nothing while outside one). A block retired while
+ * the global epoch is e may still be seen by readers that entered during
+ * e-1 or e, but not by any that enter later, so it is safe to free once
+ * the epoch reaches e+2.
+ *
+ * Each record keeps three bags of retired blocks, one per epoch modulo 3.
+ * Retiring is a push onto the bag of the current epoch, without locking.
+ * When a thread finds its bag still holding blocks from three epochs ago,
+ * those are safe and freed first. Every EPOCH_BATCH retires the thread also
+ * tries to advance the epoch and frees its safe bags. A bag is freed with
+ * one myfree_batch call under the heap lock (myheap_lock), which guards
+ * every heap call made here, so reclaims are safe next to threads that
+ * take the same lock around their own heap calls.
+ *
+ * Records are kept in a list that only grows; a record whose thread has
+ * exited is reused by the next thread to register. On exit, a thread moves
+ * its retired blocks into the orphan bags, which any reclaim frees once
+ * they are safe.
+ *
+ * Records and bags live on the main heap, so a reset hook (myatreset)
+ * drops them all when myinit discards the heap. It also bumps a
+ * generation, which tells every thread that its own record is gone and it
+ * must register again.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "allocator.h"
+#include "epoch.h"
+
+#define NBAGS 3
+#define ACTIVE 1UL    // low bit of a record's state: inside a read-side section
+
+typedef struct {
+    unsigned long epoch;    // epoch the blocks were retired in
+    size_t n;               // blocks in the bag
+    size_t cap;             // room in blocks[]
+    void **blocks;
+} bagT;
+
+typedef struct record {
+    unsigned long state;    // observed epoch << 1 | ACTIVE inside a section, 0 outside
+    bool in_use;            // owned by a live thread
+    unsigned nesting;       // depth of read-side sections
+    size_t nretired;        // retires since the last reclaim
+    bagT bags[NBAGS];       // indexed by epoch % NBAGS
+    struct record *next;
+} recordT;
+
+static unsigned long global_epoch = 0;
+static recordT *records = NULL;          // all records, newest first
+static bagT orphans[NBAGS];              // blocks left by exited threads, guarded by the heap lock
+static unsigned long generation = 0;     // bumped by every heap reset, which discards the records
+static bool hook_set = false;            // drop_records is registered with myatreset
+
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;         // destructor hands the record back at thread exit
+static __thread recordT *self = NULL;
+static __thread unsigned long self_generation;   // generation self was registered in
+
+static void release_record(void *arg);
+
+static void make_record_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+// Reset hook: forgets the records and bags myinit is about to discard, along with the blocks they held
+static void drop_records(void)
+{
+    records = NULL;
+    memset(orphans, 0, sizeof(orphans));
+    generation++;
+    self = NULL;
+}
+
+// Helper function to find the calling thread's record, registering it on first use and after a heap reset
+static recordT *get_record(void)
+{
+    unsigned long gen = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+    if (self != NULL && self_generation == gen) return self;
+    pthread_once(&record_key_once, make_record_key);
+    myheap_lock();
+    bool hooked = hook_set || (hook_set = myatreset(drop_records));
+    myheap_unlock();
+    if (!hooked) return NULL;
+    recordT *rec;
+    for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        bool unused = false;
+        if (__atomic_compare_exchange_n(&rec->in_use, &unused, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;   // reuse the record of a thread that exited
+    }
+    if (rec == NULL) {
+        myheap_lock();
+        rec = mymalloc(sizeof(recordT));
+        myheap_unlock();
+        if (rec == NULL) return NULL;
+        memset(rec, 0, sizeof(recordT));
+        rec->in_use = true;
+        rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&records, &rec->next, rec, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(record_key, rec);
+    self = rec;
+    self_generation = gen;
+    return rec;
+}
+
+bool epoch_enter(void)
+{
+    recordT *rec = get_record();
+    if (rec == NULL) return false;
+    if (rec->nesting++ == 0) {
+        __atomic_store_n(&rec->state, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED) << 1 | ACTIVE, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);   // announce before reading any shared node
+    }
+    return true;
+}
+
+void epoch_exit(void)
+{
+    recordT *rec = self;
+    if (--rec->nesting == 0)
+        __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+// Helper function to move the epoch on by one if every thread inside a section has observed it
+static void try_advance(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);   // retired blocks are unlinked before the scan
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for (recordT *rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        unsigned long state = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+        if ((state & ACTIVE) && (state >> 1) != e) return;
+    }
+    __atomic_compare_exchange_n(&global_epoch, &e, e+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// Helper function to free the bag's blocks if they are safe at epoch e, returns how many were freed.
+// Called with the heap lock held
+static size_t release_if_safe(bagT *bag, unsigned long e)
+{
+    if (bag->n == 0 || bag->epoch + 2 > e) return 0;
+    size_t n = bag->n;
+    myfree_batch(bag->blocks, n);
+    bag->n = 0;
+    return n;
+}
+
+/* Helper function to ready the bag for more blocks retired in epoch e. The
+ * bag is emptied first if it holds blocks of an earlier epoch, which share
+ * its index and so are at least three epochs old, then grown if needed.
+ * Returns false if it cannot grow. Called with the heap lock held.
+ */
+static bool bag_reserve(bagT *bag, unsigned long e, size_t more)
+{
+    if (bag->epoch != e) {
+        if (bag->n != 0) myfree_batch(bag->blocks, bag->n);
+        bag->n = 0;
+        bag->epoch = e;
+    }
+    if (bag->n + more <= bag->cap) return true;
+    size_t cap = bag->cap ? bag->cap : EPOCH_BATCH;
+    while (cap < bag->n + more) cap *= 2;
+    void **blocks = myrealloc(bag->blocks, cap * sizeof(void *));
+    if (blocks == NULL) return false;
+    bag->blocks = blocks;
+    bag->cap = cap;
+    return true;
+}
+
+// Helper function to advance the epoch if possible and free the safe blocks of rec and of the orphans
+static size_t reclaim(recordT *rec)
+{
+    try_advance();
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    size_t nfreed = 0;
+    myheap_lock();
+    for (int i = 0; i < NBAGS; i++) {
+        nfreed += release_if_safe(&rec->bags[i], e);
+        nfreed += release_if_safe(&orphans[i], e);
+    }
+    myheap_unlock();
+    rec->nretired = 0;
+    return nfreed;
+}
+
+void myfree_deferred(void *ptr)
+{
+    if (ptr == NULL) return;
+    recordT *rec = get_record();
+    if (rec == NULL) return;   // cannot track the block, leaking it is the only safe choice
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);   // the block is unlinked before the epoch is read
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    bagT *bag = &rec->bags[e % NBAGS];
+    if (bag->epoch != e || bag->n == bag->cap) {
+        myheap_lock();
+        bool ok = bag_reserve(bag, e, 1);
+        myheap_unlock();
+        if (!ok) return;       // as above
+    }
+    bag->blocks[bag->n++] = ptr;
+    if (++rec->nretired >= EPOCH_BATCH) reclaim(rec);
+}
+
+size_t epoch_reclaim(void)
+{
+    recordT *rec = get_record();
+    if (rec == NULL) return 0;
+    size_t nfreed = reclaim(rec);
+    return nfreed + reclaim(rec);   // blocks retired in the current epoch need it to move on twice
+}
+
+// Destructor for the record key: hands the thread's retired blocks to the orphans and its record to the next thread
+static void release_record(void *arg)
+{
+    recordT *rec = arg;
+    if (self_generation != __atomic_load_n(&generation, __ATOMIC_RELAXED)) {
+        self = NULL;   // the record went with a heap reset
+        return;
+    }
+    rec->nesting = 0;
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    myheap_lock();
+    for (int i = 0; i < NBAGS; i++) {
+        bagT *bag = &rec->bags[i];
+        if (bag->n == 0) continue;
+        bagT *orphan = &orphans[bag->epoch % NBAGS];
+        if (orphan->epoch > bag->epoch) {
+            myfree_batch(bag->blocks, bag->n);   // the orphans are three epochs on, so the bag is safe
+        } else if (bag_reserve(orphan, bag->epoch, bag->n)) {
+            memcpy(&orphan->blocks[orphan->n], bag->blocks, bag->n * sizeof(void *));
+            orphan->n += bag->n;
+        }   // else the orphans cannot grow and the blocks are leaked
+        bag->n = 0;
+    }
+    myheap_unlock();
+    self = NULL;
+    __atomic_store_n(&rec->in_use, false, __ATOMIC_RELEASE);
+}
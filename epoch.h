@@ -0,0 +1,63 @@
+/* File: epoch.h
+ * -------------
+ * Interface for deferred freeing with epoch-based reclamation. A lock-free
+ * data structure cannot free a node as soon as it is unlinked, because
+ * readers may still be looking at it. Instead the node is retired with
+ * myfree_deferred and freed once every thread that could have seen it has
+ * moved on. Readers announce themselves by bracketing their accesses with
+ * epoch_enter/epoch_exit.
+ *
+ * The main heap is not thread safe: retired blocks are freed (with
+ * myfree_batch) under the heap lock (myheap_lock), so while deferred frees
+ * are in use from several threads, other threads must take that lock around
+ * their own heap calls. The per-thread records and retire lists live on
+ * the main heap: myinit drops them, and the blocks still retired go with
+ * the rest of the heap. It must not be called while any thread is inside a
+ * read-side section or calling these functions.
+ */
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+/* Constant: EPOCH_BATCH
+ * ---------------------
+ * A thread tries to advance the epoch and free the blocks it retired that
+ * have become safe every EPOCH_BATCH calls to myfree_deferred.
+ */
+#define EPOCH_BATCH 64
+
+/* Functions: epoch_enter, epoch_exit
+ * ----------------------------------
+ * Bracket a read-side critical section: a block that is retired after
+ * epoch_enter is not freed before the matching epoch_exit. Sections nest.
+ * The first call on a thread registers it, which needs a little heap
+ * memory; epoch_enter returns false if that fails, and the caller must not
+ * go on to read shared nodes or call epoch_exit.
+ */
+bool epoch_enter(void);
+void epoch_exit(void);
+
+/* Function: myfree_deferred
+ * -------------------------
+ * Retires a block obtained from the heap: it is freed as myfree would, but
+ * only once no thread is still inside a read-side section that began before
+ * the call. The caller must already have made the block unreachable for
+ * new readers. May be called inside or outside a read-side section. NULL
+ * is ignored. If the thread cannot be registered or its retire list cannot
+ * grow, the block is never freed.
+ */
+void myfree_deferred(void *ptr);
+
+/* Function: epoch_reclaim
+ * -----------------------
+ * Advances the epoch as far as the threads inside read-side sections allow
+ * and frees the calling thread's retired blocks that have become safe, as
+ * well as those left behind by threads that exited. With no thread inside
+ * a section, every block retired so far by the calling thread is freed.
+ * Returns the number of blocks freed.
+ */
+size_t epoch_reclaim(void);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * File: epochbench.c
+ * ------------------
+ * Exercises deferred freeing with epochs. First a few checks of when
+ * retired blocks get freed: not while a reader that entered before the
+ * retire is still inside its section, all of them once it has left, those
+ * of a thread that exited by whoever reclaims next, and the same again
+ * after myinit has reset the heap. Then a stress run: reader threads look
+ * up nodes in a table inside read-side sections while the main thread keeps
+ * replacing them and retiring the old ones with myfree_deferred. A reader
+ * that sees a node change under it has read freed memory. The cycles per
+ * replacement are printed; any failed check makes the program exit with
+ * status 1.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "epoch.h"
+#include "fcyc.h"
+
+#define NODE_MAGIC 0x6e6f6465UL
+#define NSLOTS 256
+#define NCHECKED 1000                // blocks retired by each check
+#define MAX_READERS 64
+
+typedef struct {
+    unsigned long magic;
+    unsigned long value;             // unique per node, so reuse of the block shows
+} node;
+
+static int nreaders = 4;             // reader threads in the stress run (-t)
+static int nreplaces = 200000;       // node replacements in the stress run (-n)
+static node *slots[NSLOTS];
+static bool done;
+static int failures;
+
+// lets check_reader hold a reader inside its section
+static pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_stage;               // 1 once the reader is inside, 2 once it may leave
+
+static void usage(void);
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "FAILED: %s\n", what);
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+// Allocates a node under the heap lock, which deferred frees on other threads take too
+static node *new_node(unsigned long value)
+{
+    myheap_lock();
+    node *n = mymalloc(sizeof(node));
+    myheap_unlock();
+    if (n != NULL) {
+        n->magic = NODE_MAGIC;
+        n->value = value;
+    }
+    return n;
+}
+
+// Retires count fresh blocks, returns false if one cannot be allocated
+static bool retire_blocks(int count)
+{
+    for (int i = 0; i < count; i++) {
+        node *n = new_node(i);
+        if (n == NULL) return false;
+        myfree_deferred(n);
+    }
+    return true;
+}
+
+// A reader for check_reader: stays inside a section until told to leave
+static void *pinning_reader(void *arg)
+{
+    (void)arg;
+    bool entered = epoch_enter();
+    pthread_mutex_lock(&gate);
+    gate_stage = 1;
+    pthread_cond_broadcast(&gate_cond);
+    while (gate_stage < 2) pthread_cond_wait(&gate_cond, &gate);
+    pthread_mutex_unlock(&gate);
+    if (entered) epoch_exit();
+    return NULL;
+}
+
+// Checks that blocks retired while another thread is inside a section wait for it to leave
+static void check_reader(void)
+{
+    pthread_t tid;
+    gate_stage = 0;
+    pthread_create(&tid, NULL, pinning_reader, NULL);
+    pthread_mutex_lock(&gate);
+    while (gate_stage < 1) pthread_cond_wait(&gate_cond, &gate);
+    pthread_mutex_unlock(&gate);
+
+    if (!retire_blocks(NCHECKED)) fail("allocating the blocks to retire");
+    if (epoch_reclaim() != 0) fail("blocks freed while a reader is inside a section");
+
+    pthread_mutex_lock(&gate);
+    gate_stage = 2;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate);
+    pthread_join(tid, NULL);
+    if (epoch_reclaim() != NCHECKED) fail("blocks not freed once the reader left");
+}
+
+// Retires fewer blocks than EPOCH_BATCH, so the thread itself never frees any
+static void *retiring_thread(void *arg)
+{
+    *(bool *)arg = retire_blocks(EPOCH_BATCH - 1);
+    return NULL;
+}
+
+// Checks that blocks retired by a thread that exited are freed by the next reclaim
+static void check_orphans(void)
+{
+    pthread_t tid;
+    bool ok = false;
+    pthread_create(&tid, NULL, retiring_thread, &ok);
+    pthread_join(tid, NULL);
+    if (!ok) fail("allocating the blocks to retire");
+    if (epoch_reclaim() != EPOCH_BATCH - 1) fail("blocks of an exited thread not freed");
+}
+
+/* Checks that myinit drops the blocks retired before it and that those
+ * retired after it are tracked and freed as before. Fewer than EPOCH_BATCH
+ * are retired each time, so none are freed before epoch_reclaim.
+ */
+static void check_reset(void)
+{
+    if (!retire_blocks(EPOCH_BATCH / 2)) fail("allocating the blocks to retire");
+    myinit();
+    if (!epoch_enter()) {
+        fail("epoch_enter after myinit");
+        return;
+    }
+    epoch_exit();
+    if (!retire_blocks(EPOCH_BATCH - 1)) fail("allocating the blocks to retire");
+    if (epoch_reclaim() != EPOCH_BATCH - 1) fail("blocks retired after myinit not freed");
+}
+
+// A reader for the stress run: looks up random nodes and checks they do not change while in use
+static void *stress_reader(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg;
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        if (!epoch_enter()) {
+            fail("epoch_enter in a reader");
+            return NULL;
+        }
+        node *n = __atomic_load_n(&slots[rand_r(&seed) % NSLOTS], __ATOMIC_ACQUIRE);
+        unsigned long value = n->value;
+        for (volatile int spin = 0; spin < 100; spin++)
+            ;
+        if (n->magic != NODE_MAGIC || n->value != value) {
+            fail("node changed under a reader");
+            epoch_exit();
+            return NULL;
+        }
+        epoch_exit();
+    }
+    return NULL;
+}
+
+// Replaces random nodes while nreaders threads read them, returns the cycles per replacement
+static double stress(void)
+{
+    myinit();
+    for (int i = 0; i < NSLOTS; i++)
+        slots[i] = new_node(i);
+    done = false;
+    pthread_t tids[MAX_READERS];
+    for (int i = 0; i < nreaders; i++)
+        pthread_create(&tids[i], NULL, stress_reader, (void *)(size_t)(i + 1));
+
+    start_counter();
+    for (int i = 0; i < nreplaces; i++) {
+        node *n = new_node(NSLOTS + i);
+        if (n == NULL) {
+            fail("allocating a node");
+            break;
+        }
+        node *old = __atomic_exchange_n(&slots[rand() % NSLOTS], n, __ATOMIC_ACQ_REL);
+        myfree_deferred(old);
+    }
+    double cycles = get_counter();
+
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < nreaders; i++)
+        pthread_join(tids[i], NULL);
+    epoch_reclaim();
+    for (int i = 0; i < NSLOTS; i++)
+        myfree(slots[i]);
+    return cycles / nreplaces;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "t:n:")) != EOF) {
+        switch (c) {
+            case 't':
+                nreaders = atoi(optarg);
+                break;
+            case 'n':
+                nreplaces = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nreaders < 0 || nreaders > MAX_READERS || nreplaces <= 0) usage();
+
+    myinit();
+    epoch_reclaim();   // registers the main thread outside the checks
+    check_reader();
+    check_orphans();
+    check_reset();
+    double cycles = stress();
+
+    printf("%d replacements with %d readers: %.1f cycles per replacement\n", nreplaces, nreaders, cycles);
+    if (failures > 0) return 1;
+    printf("all checks passed\n");
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: epochbench [-t <readers>] [-n <replacements>]\n");
+    fprintf(stderr, "\t-t <readers>       Reader threads in the stress run, at most %d (default 4).\n", MAX_READERS);
+    fprintf(stderr, "\t-n <replacements>  Nodes replaced in the stress run (default 200000).\n");
+    exit(107);
+}
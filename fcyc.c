@@ -28,6 +28,7 @@ static double epsilon = EPSILON;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static test_funct setup_fn = NULL;   /* called before each run, untimed */
 
 static int *cache_buf = NULL;
 
@@ -178,6 +179,11 @@ static void clear()
     sink = x;
 }
 
+void set_fcyc_setup(test_funct setup)
+{
+    setup_fn = setup;
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
@@ -187,6 +193,8 @@ double fcyc(test_funct f, void *argp)
     init_sampler();
     do {
         double cyc;
+        if (setup_fn)
+            setup_fn(argp);
         if (clear_cache)
             clear();
         start_counter();
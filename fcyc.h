@@ -18,4 +18,13 @@ double fcyc(test_funct f, void* argp);
 /* Compute number of seconds used by test function f */
 double fsecs(test_funct f, void* argp);
 
+/* Have fcyc/fsecs call setup(argp) before each run of the test function,
+   outside the timed part (NULL for none) */
+void set_fcyc_setup(test_funct setup);
+
+/* Read the cycle counter: start_counter records the current value and
+   get_counter returns the cycles elapsed since then (x86 only) */
+void start_counter(void);
+double get_counter(void);
+
 #endif
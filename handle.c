@@ -0,0 +1,334 @@
+/*
+ * File: handle.c
+ * --------------
+ * The handle heap, a compacting heap on top of the segment's chunk layer.
+ *
+ * Blocks live in areas, chunks that start with a small header. Blocks are
+ * carved from the newest area by bumping a pointer (its top), each block
+ * starting with a header that records its size and the handle that owns
+ * it, so an area can be walked in address order. A freed block only loses
+ * its owner; freed blocks below a top are garbage until the next
+ * compaction, which walks each area and slides every live, unlocked block
+ * down over the garbage, updating the address in its handle. A locked block
+ * stays put; blocks further up fill the hole in front of it as far as they
+ * fit, and what they leave of it becomes a free block. Areas left empty are
+ * given back, except the newest.
+ *
+ * When the newest area runs out of room, the heap is compacted if enough
+ * of it is garbage and grown otherwise. Growing maps a chunk twice the size
+ * of the heap and slides all blocks into it, which needs every block to be
+ * unlocked. While some block is locked, a new area as large as the heap so
+ * far is added instead and the blocks stay where they are; the next growth
+ * with no block locked brings them back into one area.
+ *
+ * Handles are entries in tables of their own chunks, which never move.
+ * Like the slots of an object pool, unused entries are handed out by
+ * bumping a pointer and freed ones are kept on a stack.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "handle.h"
+#include "segment.h"
+
+struct hentry {
+    union {
+        char *ptr;               // address of the block's payload
+        struct hentry *next;     // next free entry, while the handle is unused
+    };
+    unsigned locks;              // hlock calls not yet matched by hunlock
+};
+
+// header at the start of every block
+typedef struct {
+    struct hentry *owner;        // handle of the block, NULL once freed
+    size_t size;                 // bytes in the block, header included
+} blockT;
+
+#define BLOCK_HDR_SZ sizeof(blockT)
+#define BLOCK_ALIGN 16           // keeps payloads aligned for any HEAP_ALIGNMENT
+
+// header at the start of every chunk holding blocks, followed by the blocks
+typedef struct area {
+    struct area *next;           // next older area
+    char *top;                   // end of its last block
+    char *end;                   // end of the chunk
+    size_t garbage;              // bytes in its freed blocks below the top
+} areaT;
+
+#define AREA_HDR_SZ ((sizeof(areaT) + BLOCK_ALIGN-1) / BLOCK_ALIGN * BLOCK_ALIGN)
+
+// header at the start of every table chunk, followed by the entries
+typedef struct table {
+    struct table *next;
+} tableT;
+
+#define TABLE_SIZE CHUNK_SIZE
+#define TABLE_HDR_SZ ((sizeof(tableT) + sizeof(struct hentry)-1) / sizeof(struct hentry) * sizeof(struct hentry))
+
+// static variables track the blocks
+static areaT *areas = NULL;      // all areas, newest (the one blocks are carved from) first
+static size_t footprint = 0;     // bytes mapped for areas
+static size_t garbage = 0;       // bytes in freed blocks below the tops, all areas
+static size_t nlocked = 0;       // number of blocks locked at least once
+
+// static variables track the handles
+static tableT *tables = NULL;            // all table chunks, newest first
+static struct hentry *free_entries = NULL;
+static struct hentry *entry_bump = NULL; // next never-used entry of the newest table
+static struct hentry *entry_limit = NULL;
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+static inline blockT *block_of(handle_t h)
+{
+    return (blockT *)(h->ptr - BLOCK_HDR_SZ);
+}
+
+static inline char *first_block(areaT *area)
+{
+    return (char *)area + AREA_HDR_SZ;
+}
+
+// Bytes left at the top of the newest area, 0 if there is none
+static inline size_t room(void)
+{
+    return areas == NULL ? 0 : areas->end - areas->top;
+}
+
+// Helper function to get an unused handle, returns NULL if a new table cannot be mapped
+static handle_t new_entry(void)
+{
+    if (free_entries != NULL) {
+        handle_t h = free_entries;
+        free_entries = h->next;
+        return h;
+    }
+    if (entry_bump == entry_limit) {
+        tableT *table = chunk_alloc(TABLE_SIZE);
+        if (table == NULL) return NULL;
+        table->next = tables;
+        tables = table;
+        entry_bump = (struct hentry *)((char *)table + TABLE_HDR_SZ);
+        entry_limit = (struct hentry *)((char *)table + TABLE_SIZE);
+    }
+    return entry_bump++;
+}
+
+/* Helper function to move the blocks of area to dst and up, in address
+ * order, leaving out freed ones. Locked blocks are left in place, which
+ * only works when sliding within the area. The gap in front of a locked
+ * block is kept as a hole that later blocks drop into while they fit; once
+ * the next locked block opens a new hole, what is left of the old one is
+ * made a free block and counted as the area's garbage.
+ * Returns the end of the last block moved or left in place.
+ */
+static char *slide(areaT *area, char *dst)
+{
+    char *hole = NULL, *hole_end = NULL;
+    garbage -= area->garbage;
+    area->garbage = 0;
+    char *cur = first_block(area);
+    while (cur < area->top) {
+        blockT *b = (blockT *)cur;
+        struct hentry *owner = b->owner;
+        size_t size = b->size;
+        cur += size;
+        if (owner == NULL) continue;
+        if (owner->locks > 0) {
+            if (dst < (char *)b) {
+                if (hole < hole_end) {
+                    *(blockT *)hole = (blockT){.owner = NULL, .size = hole_end - hole};
+                    area->garbage += hole_end - hole;
+                }
+                hole = dst;
+                hole_end = (char *)b;
+            }
+            dst = cur;
+            continue;
+        }
+        char *to = dst;
+        if ((size_t)(hole_end - hole) >= size) {
+            to = hole;
+            hole += size;
+        } else {
+            dst += size;
+        }
+        if (to != (char *)b) memmove(to, b, size);
+        owner->ptr = to + BLOCK_HDR_SZ;
+    }
+    if (hole < hole_end) {
+        *(blockT *)hole = (blockT){.owner = NULL, .size = hole_end - hole};
+        area->garbage += hole_end - hole;
+    }
+    garbage += area->garbage;
+    return dst;
+}
+
+// Helper function to unmap an area and forget it, prev is the newer area linking to it (NULL for the newest)
+static void release_area(areaT *area, areaT *prev)
+{
+    if (prev == NULL) areas = area->next; else prev->next = area->next;
+    footprint -= area->end - (char *)area;
+    chunk_release(area);
+}
+
+// Helper function to compact every area, giving back those left empty except the newest
+static void compact(void)
+{
+    areaT *prev = NULL;
+    for (areaT *area = areas, *next; area != NULL; area = next) {
+        next = area->next;
+        area->top = slide(area, first_block(area));
+        if (area->top == first_block(area) && area != areas)
+            release_area(area, prev);
+        else
+            prev = area;
+    }
+}
+
+// Helper function to map a new area of at least size bytes and make it the newest, NULL if it cannot be mapped
+static areaT *add_area(size_t size)
+{
+    areaT *area = chunk_alloc(size);
+    if (area == NULL) return NULL;
+    area->next = areas;
+    area->top = first_block(area);
+    area->end = (char *)area + chunk_size(area);
+    area->garbage = 0;
+    areas = area;
+    footprint += area->end - (char *)area;
+    return area;
+}
+
+/* Helper function to grow the heap so the newest area has room for need
+ * more bytes. With no block locked, all blocks move to one new area twice
+ * the size of the heap; otherwise a new area as large as the heap so far
+ * is added and the blocks stay where they are.
+ */
+static bool grow(size_t need)
+{
+    size_t live = footprint - garbage;   // an upper bound, headers and free tops included
+    size_t size = (nlocked > 0) ? footprint : 2*footprint;
+    if (nlocked == 0 && size < live + need) size = live + need;
+    if (size < AREA_HDR_SZ + need) size = AREA_HDR_SZ + need;
+    areaT *old = areas;
+    areaT *area = add_area(size);
+    if (area == NULL) return false;
+    if (nlocked > 0) return true;
+    for (areaT *next; old != NULL; old = next) {
+        next = old->next;
+        area->top = slide(old, area->top);
+        release_area(old, area);
+    }
+    return true;
+}
+
+// Helper function to make room for need bytes at the top of the newest area, returns false if there is none
+static bool make_room(size_t need)
+{
+    if (garbage > 0 && garbage >= footprint / HANDLE_MAX_GARBAGE) {
+        compact();
+        if (room() >= need) return true;
+    }
+    if (grow(need)) return true;
+    if (garbage == 0) return false;
+    compact();  // cannot grow, so any garbage is worth squeezing out
+    return room() >= need;
+}
+
+handle_t hmalloc(size_t size)
+{
+    if (size == 0 || size > MAX_SEGMENT_RESERVE) return NULL;
+    size_t need = roundup(size + BLOCK_HDR_SZ, BLOCK_ALIGN);
+    if (room() < need && !make_room(need)) return NULL;
+    handle_t h = new_entry();
+    if (h == NULL) return NULL;
+    blockT *b = (blockT *)areas->top;
+    b->owner = h;
+    b->size = need;
+    areas->top += need;
+    h->ptr = (char *)b + BLOCK_HDR_SZ;
+    h->locks = 0;
+    return h;
+}
+
+void hfree(handle_t h)
+{
+    if (h == NULL) return;
+    blockT *b = block_of(h);
+    areaT *area = chunk_lookup(b);
+    b->owner = NULL;
+    if ((char *)b + b->size == area->top) {
+        area->top = (char *)b;   // last block, give it straight back to the top
+    } else {
+        area->garbage += b->size;
+        garbage += b->size;
+    }
+    if (h->locks > 0) nlocked--;
+    h->next = free_entries;
+    free_entries = h;
+}
+
+void *hlock(handle_t h)
+{
+    if (h->locks++ == 0) nlocked++;
+    return h->ptr;
+}
+
+void hunlock(handle_t h)
+{
+    if (--h->locks == 0) nlocked--;
+}
+
+size_t hsize(handle_t h)
+{
+    return block_of(h)->size - BLOCK_HDR_SZ;
+}
+
+void hcompact(void)
+{
+    compact();
+    areaT *prev = NULL;
+    for (areaT *area = areas, *next; area != NULL; area = next) {
+        next = area->next;
+        if (area->top == first_block(area)) {   // nothing left, give back the whole chunk
+            release_area(area, prev);
+            continue;
+        }
+        footprint -= area->end - (char *)area;
+        chunk_shrink(area, area->top - (char *)area);
+        area->end = (char *)area + chunk_size(area);
+        footprint += area->end - (char *)area;
+        prev = area;
+    }
+}
+
+size_t hheap_footprint(void)
+{
+    return footprint;
+}
+
+size_t hheap_live(void)
+{
+    size_t used = 0;
+    for (areaT *area = areas; area != NULL; area = area->next)
+        used += area->top - first_block(area);
+    return used - garbage;
+}
+
+void hheap_release(void)
+{
+    while (areas != NULL) release_area(areas, NULL);
+    garbage = 0;
+    nlocked = 0;
+    while (tables != NULL) {
+        tableT *next = tables->next;
+        chunk_release(tables);
+        tables = next;
+    }
+    free_entries = entry_bump = entry_limit = NULL;
+}
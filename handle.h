@@ -0,0 +1,88 @@
+/* File: handle.h
+ * --------------
+ * Interface for the handle heap, a compacting heap reached through handles.
+ * Clients of mymalloc hold raw pointers, so a block can never move and holes
+ * left by freed blocks stay until something of the right size fills them.
+ * Here the client holds a handle instead and asks for the block's address
+ * only while using it (hlock/hunlock). Unlocked blocks may be moved, which
+ * lets the heap slide them together, squeezing out the holes, and give the
+ * space past the last block back to the OS. This suits caches and document
+ * stores that can afford one indirection per access.
+ *
+ * The handle heap is separate from the main heap: it lives in chunks (see
+ * segment.h) and myinit does not touch it. It is not thread safe.
+ */
+#ifndef _HANDLE_H
+#define _HANDLE_H
+
+#include <stddef.h>  // for size_t
+
+/* Constant: HANDLE_MAX_GARBAGE
+ * ----------------------------
+ * When an allocation does not fit, the heap is compacted if at least
+ * 1/HANDLE_MAX_GARBAGE of it is taken up by freed blocks, and grown
+ * otherwise. Without locked blocks this bounds the space lost to holes.
+ */
+#define HANDLE_MAX_GARBAGE 4
+
+typedef struct hentry *handle_t;
+
+/* Function: hmalloc
+ * -----------------
+ * Allocates a block of size bytes and returns a handle to it, or NULL if
+ * size is 0 or no memory is left. The block's address is obtained with
+ * hlock. Growing the heap moves every block into one larger chunk; while
+ * any block is locked, it adds a chunk instead and no block moves.
+ */
+handle_t hmalloc(size_t size);
+
+/* Function: hfree
+ * ---------------
+ * Releases the block of a handle obtained from hmalloc, locked or not. The
+ * handle must not be used afterwards. NULL is ignored.
+ */
+void hfree(handle_t h);
+
+/* Functions: hlock, hunlock
+ * -------------------------
+ * hlock pins the block of a handle and returns its address, aligned to
+ * HEAP_ALIGNMENT. The address stays valid until the matching hunlock;
+ * after that the block may be moved and its old address must not be used.
+ * Locks nest: a block locked n times stays pinned until unlocked n times.
+ */
+void *hlock(handle_t h);
+void hunlock(handle_t h);
+
+/* Function: hsize
+ * ---------------
+ * Returns the number of bytes available in the block of a handle, which is
+ * at least the size requested from hmalloc.
+ */
+size_t hsize(handle_t h);
+
+/* Function: hcompact
+ * ------------------
+ * Slides all unlocked blocks toward the start of their chunk, then shrinks
+ * each chunk to what is in use: whole chunk units past the last block are
+ * unmapped, the remaining pages past it are discarded, and chunks left
+ * empty are given back. A locked block stays where it is; blocks further up
+ * fill the hole in front of it where they fit.
+ */
+void hcompact(void);
+
+/* Functions: hheap_footprint, hheap_live
+ * --------------------------------------
+ * hheap_footprint returns the bytes mapped for blocks, hheap_live the bytes
+ * taken up by live blocks, block headers included.
+ */
+size_t hheap_footprint(void);
+size_t hheap_live(void);
+
+/* Function: hheap_release
+ * -----------------------
+ * Frees every block and handle and gives all memory of the handle heap back
+ * to the OS. Handles obtained before must not be used afterwards.
+ */
+void hheap_release(void);
+
+#endif
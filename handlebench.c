@@ -0,0 +1,155 @@
+/*
+ * File: handlebench.c
+ * -------------------
+ * Exercises the handle heap. Allocates blocks of random size through
+ * handles, frees a random half of them while one block is held locked and
+ * compacts the heap, timing hcompact and printing the footprint and live
+ * bytes before and after. It then keeps allocating, still holding the lock,
+ * until the heap has had to grow, and allocates again once the lock is
+ * released. Along the way it checks that the contents of every live block
+ * survive the moves and that the locked block never moves; any failure is
+ * reported and makes the program exit with status 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "fcyc.h"
+#include "handle.h"
+#include "segment.h"   // for CHUNK_SIZE
+
+#define MAX_BLOCKS 1000000
+
+static int nblocks = 20000;          // blocks allocated at the start (-n)
+static size_t maxsize = 1000;        // largest block size (-s)
+static handle_t handles[MAX_BLOCKS];
+static size_t sizes[MAX_BLOCKS];
+static int nlive;                    // handles[0..nlive) are allocated, NULL entries were freed
+static int failures;
+
+static void usage(void);
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+}
+
+// Allocates a block of random size and fills it with a pattern derived from its index
+static bool alloc_block(void)
+{
+    if (nlive == MAX_BLOCKS) return false;
+    size_t size = 1 + rand() % maxsize;
+    handle_t h = hmalloc(size);
+    if (h == NULL) return false;
+    memset(hlock(h), nlive, size);
+    hunlock(h);
+    handles[nlive] = h;
+    sizes[nlive++] = size;
+    return true;
+}
+
+// Checks the pattern of every live block, reports the first block that lost it
+static void check_blocks(const char *when)
+{
+    for (int i = 0; i < nlive; i++) {
+        if (handles[i] == NULL) continue;
+        unsigned char *p = hlock(handles[i]);
+        for (size_t j = 0; j < sizes[i]; j++) {
+            if (p[j] != (unsigned char)i) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "block %d lost its contents %s", i, when);
+                fail(msg);
+                hunlock(handles[i]);
+                return;
+            }
+        }
+        hunlock(handles[i]);
+    }
+}
+
+static void print_heap(const char *when)
+{
+    printf("%-28s %14zu %14zu\n", when, hheap_footprint(), hheap_live());
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:s:")) != EOF) {
+        switch (c) {
+            case 'n':
+                nblocks = atoi(optarg);
+                break;
+            case 's':
+                maxsize = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nblocks < 2 || nblocks > MAX_BLOCKS / 4 || maxsize == 0) usage();
+
+    myinit();
+    srand(107);
+    for (int i = 0; i < nblocks; i++)
+        if (!alloc_block()) fail("hmalloc while filling the heap");
+    printf("%-28s %14s %14s\n", "heap", "footprint", "live");
+    print_heap("filled");
+
+    int pinned = nblocks / 2;
+    void *pinned_at = hlock(handles[pinned]);
+    for (int i = 0; i < nblocks; i++) {
+        if (i != pinned && rand() % 2) {
+            hfree(handles[i]);
+            handles[i] = NULL;
+        }
+    }
+    print_heap("half freed");
+    start_counter();
+    hcompact();
+    double cycles = get_counter();
+    print_heap("compacted");
+    if (hheap_footprint() > 2*hheap_live() + CHUNK_SIZE) fail("footprint not shrunk by hcompact");
+    if (hlock(handles[pinned]) != pinned_at) fail("locked block moved by hcompact");
+    hunlock(handles[pinned]);
+    check_blocks("after hcompact");
+
+    size_t before = hheap_footprint();
+    int added = 0;
+    while (hheap_footprint() <= before) {
+        if (!alloc_block()) {
+            fail("hmalloc while a block is locked");
+            break;
+        }
+        added++;
+    }
+    print_heap("grown while locked");
+    if (hlock(handles[pinned]) != pinned_at) fail("locked block moved by growing");
+    hunlock(handles[pinned]);
+    check_blocks("after growing while locked");
+
+    hunlock(handles[pinned]);
+    before = hheap_footprint();
+    while (hheap_footprint() <= before && alloc_block())
+        added++;
+    print_heap("grown unlocked");
+    check_blocks("after growing unlocked");
+
+    printf("hcompact took %.0f cycles, %d blocks added after it\n", cycles, added);
+    hheap_release();
+    if (failures > 0) return 1;
+    printf("all checks passed\n");
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: handlebench [-n <blocks>] [-s <max size>]\n");
+    fprintf(stderr, "\t-n <blocks>    Blocks allocated at the start, 2 to %d (default 20000).\n", MAX_BLOCKS / 4);
+    fprintf(stderr, "\t-s <bytes>     Largest block size (default 1000).\n");
+    exit(107);
+}
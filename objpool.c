@@ -0,0 +1,260 @@
+/*
+ * File: objpool.c
+ * ---------------
+ * Fixed-size object pools on top of the heap allocator.
+ *
+ * Slots are carved from slabs: blocks of the main heap (mymalloc, or
+ * myaligned_alloc for alignments above HEAP_ALIGNMENT) that start with a
+ * small header linking the slabs of a pool, followed by the slots. A slot
+ * has no header of its own. Free slots form an intrusive stack, the first
+ * word of each free slot pointing to the next one. Slots that were never
+ * handed out are not pushed on the stack, they are taken from the newest
+ * slab by bumping a pointer.
+ *
+ * A shared pool puts a per-thread front before that stack: a thread-local
+ * array of free slots per shared pool, refilled from the pool (under its
+ * lock) when empty and drained to it when full, half at a time. Fronts
+ * are indexed by the pool's id and stamped with the pool's generation, so
+ * a front left behind by a destroyed pool is never mistaken for a live one.
+ * When a thread exits, its fronts are drained back to their pools. Pools
+ * live on the main heap: when myinit discards them, a reset hook
+ * (myatreset) clears the table, and the fronts left behind are stale by
+ * generation like those of a destroyed pool.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "allocator.h"
+#include "objpool.h"
+
+// header at the start of every slab
+typedef struct slab {
+    struct slab *next;
+} slabT;
+
+struct objpool {
+    size_t slotsz;          // bytes per slot, a multiple of align
+    size_t align;
+    void *free_top;         // stack of free slots
+    char *bump;             // next never-used slot of the newest slab
+    char *limit;            // end of the newest slab
+    slabT *slabs;           // all slabs, newest first
+    bool shared;            // has per-thread fronts, fields above guarded by lock
+    unsigned id;            // index of its fronts, shared pools only
+    unsigned long gen;      // generation stamped on its fronts, shared pools only
+    pthread_mutex_t lock;
+};
+
+// per-thread front of a shared pool
+typedef struct {
+    unsigned long gen;      // generation of the pool the slots belong to, 0 if none
+    unsigned count;
+    void *slots[POOL_FRONT_SLOTS];
+} frontT;
+
+// Locks are taken in this order: table_lock, a pool's lock, the heap lock (myheap_lock)
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;   // guards the table of shared pools below
+static pool_t *shared_pools[POOL_MAX_SHARED];
+static unsigned long next_gen = 1;
+static bool hook_set = false;          // forget_shared_pools is registered with myatreset
+static pthread_key_t front_key;
+static pthread_once_t front_key_once = PTHREAD_ONCE_INIT;
+static __thread frontT fronts[POOL_MAX_SHARED];
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+static void drain_fronts(void *unused);
+
+static void make_front_key(void)
+{
+    pthread_key_create(&front_key, drain_fronts);
+}
+
+// Reset hook: empties the table of the shared pools myinit is about to discard
+static void forget_shared_pools(void)
+{
+    pthread_mutex_lock(&table_lock);
+    memset(shared_pools, 0, sizeof(shared_pools));
+    pthread_mutex_unlock(&table_lock);
+}
+
+static pool_t *create(size_t objsize, size_t align, bool shared)
+{
+    if (align == 0) align = HEAP_ALIGNMENT;
+    if (objsize == 0 || (align & (align-1)) != 0 || objsize > POOL_SLAB_SIZE || align > POOL_SLAB_SIZE) return NULL;
+    pool_t *pool = NULL;
+    if (shared) {
+        pthread_mutex_lock(&table_lock);
+        myheap_lock();
+        if (hook_set || (hook_set = myatreset(forget_shared_pools)))
+            pool = mymalloc(sizeof(pool_t));
+        myheap_unlock();
+    } else {
+        pool = mymalloc(sizeof(pool_t));
+    }
+    if (pool == NULL) goto out;
+    pool->slotsz = roundup(objsize < sizeof(void *) ? sizeof(void *) : objsize, align);
+    pool->align = align;
+    pool->free_top = NULL;
+    pool->bump = pool->limit = NULL;
+    pool->slabs = NULL;
+    pool->shared = shared;
+    if (shared) {
+        unsigned id = 0;
+        while (id < POOL_MAX_SHARED && shared_pools[id] != NULL) id++;
+        if (id == POOL_MAX_SHARED) {
+            myheap_lock();
+            myfree(pool);
+            myheap_unlock();
+            pool = NULL;
+            goto out;
+        }
+        pthread_once(&front_key_once, make_front_key);
+        pthread_mutex_init(&pool->lock, NULL);
+        pool->id = id;
+        pool->gen = next_gen++;
+        shared_pools[id] = pool;
+    }
+out:
+    if (shared) pthread_mutex_unlock(&table_lock);
+    return pool;
+}
+
+pool_t *pool_create(size_t objsize, size_t align)
+{
+    return create(objsize, align, false);
+}
+
+pool_t *pool_create_shared(size_t objsize, size_t align)
+{
+    return create(objsize, align, true);
+}
+
+// Helper function to start a new slab, returns false if the heap is out of memory
+static bool add_slab(pool_t *pool)
+{
+    size_t first = roundup(sizeof(slabT), pool->align);   // offset of the first slot
+    size_t slabsz = first + POOL_MIN_SLOTS*pool->slotsz;
+    if (slabsz < POOL_SLAB_SIZE) slabsz = POOL_SLAB_SIZE;
+
+    if (pool->shared) myheap_lock();
+    slabT *slab = (pool->align > HEAP_ALIGNMENT) ? myaligned_alloc(pool->align, slabsz) : mymalloc(slabsz);
+    if (slab != NULL) slabsz = myusable_size(slab);   // use the slack too
+    if (pool->shared) myheap_unlock();
+    if (slab == NULL) return false;
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->bump = (char *)slab + first;
+    pool->limit = pool->bump + (slabsz - first) / pool->slotsz * pool->slotsz;
+    return true;
+}
+
+// Helper function to take a slot from the stack or the newest slab, NULL if the heap is out of memory
+static inline void *take_slot(pool_t *pool)
+{
+    void *slot = pool->free_top;
+    if (slot != NULL) {
+        pool->free_top = *(void **)slot;
+        return slot;
+    }
+    if (pool->bump == pool->limit && !add_slab(pool)) return NULL;
+    slot = pool->bump;
+    pool->bump += pool->slotsz;
+    return slot;
+}
+
+// Helper function to get the calling thread's front of a shared pool, emptied if it was left by an older pool
+static inline frontT *front_for(pool_t *pool)
+{
+    frontT *front = &fronts[pool->id];
+    if (front->gen != pool->gen) {
+        if (front->gen == 0) pthread_setspecific(front_key, fronts);   // so it is drained at thread exit
+        front->gen = pool->gen;
+        front->count = 0;
+    }
+    return front;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    if (!pool->shared) return take_slot(pool);
+
+    frontT *front = front_for(pool);
+    if (front->count == 0) {   // refill half the front
+        pthread_mutex_lock(&pool->lock);
+        while (front->count < POOL_FRONT_SLOTS/2) {
+            void *slot = take_slot(pool);
+            if (slot == NULL) break;
+            front->slots[front->count++] = slot;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (front->count == 0) return NULL;
+    }
+    return front->slots[--front->count];
+}
+
+void pool_free(pool_t *pool, void *obj)
+{
+    if (obj == NULL) return;
+    if (!pool->shared) {
+        *(void **)obj = pool->free_top;
+        pool->free_top = obj;
+        return;
+    }
+
+    frontT *front = front_for(pool);
+    if (front->count == POOL_FRONT_SLOTS) {   // drain half the front
+        pthread_mutex_lock(&pool->lock);
+        while (front->count > POOL_FRONT_SLOTS/2) {
+            void *slot = front->slots[--front->count];
+            *(void **)slot = pool->free_top;
+            pool->free_top = slot;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    front->slots[front->count++] = obj;
+}
+
+// Thread exit destructor: gives the slots in the exiting thread's fronts back to pools that still exist
+static void drain_fronts(void *thread_fronts)
+{
+    frontT *front = thread_fronts;
+    pthread_mutex_lock(&table_lock);
+    for (int id = 0; id < POOL_MAX_SHARED; id++, front++) {
+        pool_t *pool = shared_pools[id];
+        if (pool == NULL || front->gen != pool->gen) continue;
+        pthread_mutex_lock(&pool->lock);
+        while (front->count > 0) {
+            void *slot = front->slots[--front->count];
+            *(void **)slot = pool->free_top;
+            pool->free_top = slot;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+void pool_destroy(pool_t *pool)
+{
+    if (pool == NULL) return;
+    bool shared = pool->shared;
+    if (shared) {
+        pthread_mutex_lock(&table_lock);
+        shared_pools[pool->id] = NULL;
+        pthread_mutex_unlock(&table_lock);
+        pthread_mutex_destroy(&pool->lock);
+        myheap_lock();
+    }
+    for (slabT *slab = pool->slabs; slab != NULL; ) {
+        slabT *next = slab->next;
+        myfree(slab);
+        slab = next;
+    }
+    myfree(pool);
+    if (shared) myheap_unlock();
+}
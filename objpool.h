@@ -0,0 +1,71 @@
+/* File: objpool.h
+ * ---------------
+ * Interface for fixed-size object pools. A pool hands out slots of one
+ * size: there is no per-object header and no size class lookup or free
+ * list search, allocating and freeing is a pop and a push on a stack of
+ * free slots. Slots are carved from slabs of heap memory, so objects from
+ * the same pool sit next to each other.
+ */
+#ifndef _OBJPOOL_H
+#define _OBJPOOL_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+/* Constants
+ * ---------
+ * POOL_SLAB_SIZE is the size of the slabs slots are carved from (a slab
+ * holds at least POOL_MIN_SLOTS slots, so it is larger for big objects).
+ * POOL_FRONT_SLOTS is how many free slots the per-thread front of a shared
+ * pool keeps, POOL_MAX_SHARED how many shared pools may exist at once.
+ */
+#define POOL_SLAB_SIZE (1L << 16)   // 64 KB
+#define POOL_MIN_SLOTS 16
+#define POOL_FRONT_SLOTS 64
+#define POOL_MAX_SHARED 16
+
+typedef struct objpool pool_t;
+
+/* Function: pool_create
+ * ---------------------
+ * Creates a pool of objects of objsize bytes, each aligned to align (a
+ * power of 2; 0 means HEAP_ALIGNMENT). Returns NULL if the arguments are
+ * invalid or the pool cannot be allocated. The pool is for one thread.
+ * Pools live on the main heap, so myinit discards them all, shared ones
+ * included.
+ */
+pool_t *pool_create(size_t objsize, size_t align);
+
+/* Function: pool_create_shared
+ * ----------------------------
+ * Like pool_create, but the pool may be used from several threads. Each
+ * thread gets a front of up to POOL_FRONT_SLOTS free slots it allocates
+ * from and frees to without locking; the pool behind it is locked only to
+ * refill or drain a front. The main heap itself is not thread safe: slabs
+ * are allocated under the heap lock (myheap_lock), so while a shared pool
+ * is in use, other threads must take that lock around their own heap
+ * calls. Returns NULL also if POOL_MAX_SHARED shared pools exist already.
+ */
+pool_t *pool_create_shared(size_t objsize, size_t align);
+
+/* Function: pool_alloc
+ * --------------------
+ * Returns a slot from the pool, or NULL if no memory is left.
+ */
+void *pool_alloc(pool_t *pool);
+
+/* Function: pool_free
+ * -------------------
+ * Gives a slot obtained from pool_alloc on the same pool back to it.
+ * NULL is ignored.
+ */
+void pool_free(pool_t *pool, void *obj);
+
+/* Function: pool_destroy
+ * ----------------------
+ * Releases the pool and all of its slabs, including slots still in use.
+ * NULL is ignored. A shared pool must no longer be used by any thread.
+ */
+void pool_destroy(pool_t *pool);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * File: pmrbench.cc
+ * -----------------
+ * Compares the heap with glibc malloc under standard container workloads,
+ * through the adaptors in allocator.hpp. Each workload runs four times:
+ * with std::allocator and with std::pmr::new_delete_resource (both glibc
+ * malloc underneath), and with myalloc::heap_allocator and the shared
+ * myalloc::heap_resource. The workloads are
+ *
+ *   vector         push_back of n ints into a fresh vector, growing it
+ *   map            insert n random keys, look each up, erase them all
+ *   unordered_map  insert n random keys, erase every other one, insert
+ *                  n/2 new ones, clear
+ *
+ * The cycles per element of the best of NREPEATS runs are printed.
+ *
+ * Built with -DMYALLOC_REPLACE_NEW (pmrbench_new, "make bench-new"), the
+ * global operator new and delete are the heap's, so the glibc columns run
+ * on the heap as well, through plain new. The heap then also holds the
+ * keys and is never reset between runs.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "allocator.hpp"
+extern "C" {
+#include "fcyc.h"
+}
+
+#define NREPEATS 3
+
+#ifdef MYALLOC_REPLACE_NEW
+static const bool replaced_new = true;
+#else
+static const bool replaced_new = false;
+#endif
+
+static int nelems = 200000;          // elements per workload (-n)
+static std::vector<unsigned> keys;   // random keys, the same for every run
+
+static void usage(void);
+
+template <class Vector>
+static void vector_workload(Vector v)
+{
+    for (int i = 0; i < nelems; i++)
+        v.push_back(i);
+    if (v.size() != (size_t)nelems) printf("vector lost elements\n");
+}
+
+template <class Map>
+static void map_workload(Map m)
+{
+    for (int i = 0; i < nelems; i++)
+        m.emplace(keys[i], i);
+    size_t found = 0;
+    for (int i = 0; i < nelems; i++)
+        found += m.count(keys[i]);
+    if (found != (size_t)nelems) printf("map lost keys\n");
+    for (int i = 0; i < nelems; i++)
+        m.erase(keys[i]);
+}
+
+template <class UMap>
+static void unordered_map_workload(UMap m)
+{
+    for (int i = 0; i < nelems; i++)
+        m.emplace(keys[i], i);
+    for (int i = 0; i < nelems; i += 2)
+        m.erase(keys[i]);
+    for (int i = 0; i < nelems; i += 2)
+        m.emplace(keys[i] ^ 0x80000000u, i);
+    m.clear();
+}
+
+/* Times a workload on a fresh container made by make(), returns the best
+ * cycles per element of NREPEATS runs. Runs on the heap start from an
+ * empty heap each time.
+ */
+template <class Make, class Workload>
+static double time_workload(Make make, Workload workload, bool on_heap)
+{
+    double best = 0;
+    for (int r = 0; r < NREPEATS; r++) {
+        if (on_heap && !replaced_new) myinit();
+        start_counter();
+        workload(make());
+        double cycles = get_counter() / nelems;
+        if (r == 0 || cycles < best) best = cycles;
+    }
+    return best;
+}
+
+static void print_row(const char *name, double glibc_std, double heap_std, double glibc_pmr, double heap_pmr)
+{
+    printf("%-16s %12.1f %12.1f %12.1f %12.1f\n", name, glibc_std, heap_std, glibc_pmr, heap_pmr);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:")) != EOF) {
+        switch (c) {
+            case 'n':
+                nelems = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nelems <= 0) usage();
+
+    srand(107);
+    for (int i = 0; i < nelems; i++)
+        keys.push_back((unsigned)rand() & 0x7fffffffu);
+
+    using myalloc::heap_allocator;
+    using Pair = std::pair<const unsigned, int>;
+    std::pmr::memory_resource *glibc = std::pmr::new_delete_resource();
+    std::pmr::memory_resource *heap = myalloc::heap_memory_resource();
+
+    printf("%d elements per workload, best of %d runs, cycles per element\n", nelems, NREPEATS);
+    if (replaced_new) printf("operator new and delete replaced by the heap\n");
+    printf("%-16s %12s %12s %12s %12s\n", "workload", "std glibc", "std heap", "pmr glibc", "pmr heap");
+
+    auto vec = [](auto v) { vector_workload(std::move(v)); };
+    print_row("vector",
+        time_workload([] { return std::vector<int>(); }, vec, false),
+        time_workload([] { return std::vector<int, heap_allocator<int>>(); }, vec, true),
+        time_workload([&] { return std::pmr::vector<int>(glibc); }, vec, false),
+        time_workload([&] { return std::pmr::vector<int>(heap); }, vec, true));
+
+    auto map = [](auto m) { map_workload(std::move(m)); };
+    print_row("map",
+        time_workload([] { return std::map<unsigned, int>(); }, map, false),
+        time_workload([] { return std::map<unsigned, int, std::less<unsigned>, heap_allocator<Pair>>(); }, map, true),
+        time_workload([&] { return std::pmr::map<unsigned, int>(glibc); }, map, false),
+        time_workload([&] { return std::pmr::map<unsigned, int>(heap); }, map, true));
+
+    auto umap = [](auto m) { unordered_map_workload(std::move(m)); };
+    print_row("unordered_map",
+        time_workload([] { return std::unordered_map<unsigned, int>(); }, umap, false),
+        time_workload([] { return std::unordered_map<unsigned, int, std::hash<unsigned>, std::equal_to<unsigned>, heap_allocator<Pair>>(); }, umap, true),
+        time_workload([&] { return std::pmr::unordered_map<unsigned, int>(glibc); }, umap, false),
+        time_workload([&] { return std::pmr::unordered_map<unsigned, int>(heap); }, umap, true));
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pmrbench [-n <elements>]\n");
+    fprintf(stderr, "\t-n <elements>  Elements per workload (default 200000).\n");
+    exit(107);
+}
@@ -0,0 +1,117 @@
+/*
+ * File: poolbench.c
+ * -----------------
+ * Compares allocating fixed-size objects from the main heap with taking
+ * them from an object pool. Each round allocates a number of objects of
+ * one size, writes to them and frees them all again. The rounds run with
+ * mymalloc/myfree, with a pool (pool_alloc/pool_free) and with a shared
+ * pool, which goes through the calling thread's front; the cycles per
+ * round and per alloc/free pair of each path are printed side by side.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "fcyc.h"
+#include "objpool.h"
+
+#define MAX_OBJECTS 100000
+
+static int nrounds = 10000;          // rounds run per path (-r)
+static int nobjects = 256;           // objects allocated per round (-n)
+static size_t objsize = 64;          // bytes per object (-s)
+static void *objects[MAX_OBJECTS];
+
+static void usage(void);
+
+// Allocates the objects of one round with mymalloc and frees them one by one
+static void heap_round(void)
+{
+    for (int i = 0; i < nobjects; i++) {
+        objects[i] = mymalloc(objsize);
+        memset(objects[i], i, objsize);
+    }
+    for (int i = 0; i < nobjects; i++)
+        myfree(objects[i]);
+}
+
+// Allocates the objects of one round from the pool and gives them back one by one
+static void pool_round(pool_t *pool)
+{
+    for (int i = 0; i < nobjects; i++) {
+        objects[i] = pool_alloc(pool);
+        memset(objects[i], i, objsize);
+    }
+    for (int i = 0; i < nobjects; i++)
+        pool_free(pool, objects[i]);
+}
+
+// Runs nrounds rounds on the pool (on the heap if pool is NULL), returns the cycles taken
+static double time_rounds(pool_t *pool)
+{
+    if (pool == NULL) heap_round(); else pool_round(pool);   // warm up: slabs, top chunk, fronts
+    start_counter();
+    for (int r = 0; r < nrounds; r++) {
+        if (pool == NULL) heap_round(); else pool_round(pool);
+    }
+    return get_counter();
+}
+
+static void print_row(const char *name, double cycles)
+{
+    printf("%-22s %16.0f %16.1f\n", name, cycles/nrounds, cycles/nrounds/nobjects);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "r:n:s:")) != EOF) {
+        switch (c) {
+            case 'r':
+                nrounds = atoi(optarg);
+                break;
+            case 'n':
+                nobjects = atoi(optarg);
+                break;
+            case 's':
+                objsize = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nrounds <= 0 || nobjects <= 0 || nobjects > MAX_OBJECTS ||
+        objsize == 0 || objsize > POOL_SLAB_SIZE) usage();
+
+    myinit();
+    double heap_cycles = time_rounds(NULL);
+
+    myinit();
+    pool_t *pool = pool_create(objsize, 0);
+    double pool_cycles = time_rounds(pool);
+    pool_destroy(pool);
+
+    myinit();
+    pool_t *shared = pool_create_shared(objsize, 0);
+    double shared_cycles = time_rounds(shared);
+    pool_destroy(shared);
+
+    printf("%d rounds of %d objects of %zu bytes\n", nrounds, nobjects, objsize);
+    printf("%-22s %16s %16s\n", "path", "cycles/round", "cycles/pair");
+    print_row("mymalloc + myfree", heap_cycles);
+    print_row("pool", pool_cycles);
+    print_row("shared pool", shared_cycles);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: poolbench [-r <rounds>] [-n <objects per round>] [-s <object size>]\n");
+    fprintf(stderr, "\t-r <rounds>   Number of rounds run per path (default 10000).\n");
+    fprintf(stderr, "\t-n <objects>  Objects allocated per round, at most %d (default 256).\n", MAX_OBJECTS);
+    fprintf(stderr, "\t-s <bytes>    Object size, at most %ld (default 64).\n", POOL_SLAB_SIZE);
+    exit(107);
+}
@@ -0,0 +1,232 @@
+/*
+ * File: preload.c
+ * ---------------
+ * The standard malloc API on top of the heap allocator, built into
+ * libmyalloc.so so that existing programs can be run on the allocator:
+ *
+ *     LD_PRELOAD=./libmyalloc.so sort bigfile
+ *
+ * The heap is set up on the first call, there is no myinit to call. The
+ * allocator is not thread safe, so every call into it is made under the
+ * heap lock (myheap_lock), which is also held across fork so the child
+ * starts with a consistent heap and a usable lock.
+ *
+ * Setting up can itself allocate (registering the fork handlers does), and
+ * code run early in the dynamic loader, such as dlsym, may call calloc
+ * before the heap exists. A call made by the thread that is setting up the
+ * heap is served from a small static bootstrap buffer instead. Bootstrap
+ * blocks are never reused or freed; each records its size so realloc and
+ * malloc_usable_size work on it.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "allocator.h"
+#include "segment.h"
+
+// Only the malloc API is exported, the allocator's own symbols stay hidden
+#define EXPORT __attribute__((visibility("default")))
+
+#define BOOTSTRAP_SIZE (1L << 16)   // 64 KB
+#define BOOTSTRAP_HDR_SZ 16         // size of a bootstrap block, keeps payloads 16-aligned
+
+static char bootstrap_buf[BOOTSTRAP_SIZE] __attribute__((aligned(BOOTSTRAP_HDR_SZ)));
+static size_t bootstrap_used = 0;
+
+enum { UNINIT, SETTING_UP, READY };
+static int state = UNINIT;
+static bool heap_ok = false;         // myinit succeeded
+static pthread_t setup_thread;
+static pthread_mutex_t setup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+static void before_fork(void)
+{
+    myheap_lock();
+}
+
+static void after_fork(void)
+{
+    myheap_unlock();
+}
+
+/* Helper function that sets up the heap on first use. Returns true once
+ * the heap can be used, false for a call made by the thread setting it up,
+ * which must be served from the bootstrap buffer.
+ */
+static bool heap_ready(void)
+{
+    int s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+    if (s == READY) return true;
+    if (s == SETTING_UP && pthread_equal(setup_thread, pthread_self())) return false;
+    pthread_mutex_lock(&setup_lock);
+    if (state == UNINIT) {
+        setup_thread = pthread_self();
+        __atomic_store_n(&state, SETTING_UP, __ATOMIC_RELEASE);
+        myheap_lock();
+        heap_ok = myinit();
+        myheap_unlock();
+        __atomic_store_n(&state, READY, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&setup_lock);
+        pthread_atfork(before_fork, after_fork, after_fork);   // may call malloc, the heap is ready
+        return true;
+    }
+    pthread_mutex_unlock(&setup_lock);
+    return true;
+}
+
+// Helper function to carve a block from the bootstrap buffer, returns NULL once it is used up
+static void *bootstrap_alloc(size_t align, size_t size)
+{
+    if (align < BOOTSTRAP_HDR_SZ) align = BOOTSTRAP_HDR_SZ;
+    if (size > BOOTSTRAP_SIZE || align > BOOTSTRAP_SIZE) return NULL;
+    size_t offset = roundup(bootstrap_used + BOOTSTRAP_HDR_SZ, align);
+    if (offset + size > BOOTSTRAP_SIZE) return NULL;
+    bootstrap_used = offset + size;
+    *(size_t *)(bootstrap_buf + offset - BOOTSTRAP_HDR_SZ) = size;
+    return bootstrap_buf + offset;   // the buffer starts out zero and is never reused, so calloc needs no clearing
+}
+
+static inline bool in_bootstrap(void *ptr)
+{
+    return (char *)ptr >= bootstrap_buf && (char *)ptr < bootstrap_buf + BOOTSTRAP_SIZE;
+}
+
+static inline size_t bootstrap_size(void *ptr)
+{
+    return *(size_t *)((char *)ptr - BOOTSTRAP_HDR_SZ);
+}
+
+// Helper function for all the allocating entry points: align 0 means the default alignment
+static void *allocate(size_t align, size_t size, bool zero)
+{
+    void *ptr;
+    if (size == 0) size = 1;   // malloc(0) returns a unique pointer
+    if (!heap_ready()) {
+        ptr = bootstrap_alloc(align, size);
+    } else if (!heap_ok) {
+        ptr = NULL;
+    } else {
+        myheap_lock();
+        if (align > HEAP_ALIGNMENT)
+            ptr = myaligned_alloc(align, size);
+        else
+            ptr = zero ? mycalloc(1, size) : mymalloc(size);
+        myheap_unlock();
+    }
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    return allocate(0, size, false);
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr == NULL || in_bootstrap(ptr)) return;
+    myheap_lock();
+    myfree(ptr);
+    myheap_unlock();
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return allocate(0, nmemb * size, true);
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {   // as glibc does: free the block and return NULL
+        free(ptr);
+        return NULL;
+    }
+    if (in_bootstrap(ptr)) {
+        void *newptr = malloc(size);
+        if (newptr == NULL) return NULL;
+        size_t oldsz = bootstrap_size(ptr);
+        memcpy(newptr, ptr, oldsz < size ? oldsz : size);
+        return newptr;
+    }
+    myheap_lock();
+    void *newptr = myrealloc(ptr, size);
+    myheap_unlock();
+    if (newptr == NULL) errno = ENOMEM;
+    return newptr;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+    if (align > SIZE_MAX/2 + 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t pow2 = 1;
+    while (pow2 < align) pow2 <<= 1;   // as glibc does, a non power of 2 is rounded up
+    return allocate(pow2, size, false);
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align-1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return allocate(align, size, false);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (align % sizeof(void *) != 0 || (align & (align-1)) != 0 || align == 0) return EINVAL;
+    int saved = errno;   // posix_memalign reports errors by return value only
+    void *ptr = allocate(align, size, false);
+    errno = saved;
+    if (ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return allocate(PAGE_SIZE, size, false);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    if (size > SIZE_MAX - PAGE_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return allocate(PAGE_SIZE, roundup(size, PAGE_SIZE), false);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL) return 0;
+    if (in_bootstrap(ptr)) return bootstrap_size(ptr);
+    myheap_lock();
+    size_t size = myusable_size(ptr);
+    myheap_unlock();
+    return size;
+}
@@ -2,18 +2,73 @@
  * ---------------
  * Handles low-level storage underneath the dynamic allocator. It reserves
  * the large memory segment using the OS-level mmap facility and then
- * opens it up on demand based on calls to extend.
+ * opens it up on demand based on calls to extend. It also manages the
+ * chunk layer: independently mapped, CHUNK_SIZE-aligned regions that are
+ * tracked in a small address-sorted table so any pointer can be mapped back
+ * to the chunk that holds it.
  */
 
+#define _GNU_SOURCE     // for mremap
 #include "segment.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/mman.h>
 
-// Entire segment is 8 GB
-#define MAX_SEGMENT_SIZE (1L << 33)
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23         // Linux 5.14, older headers lack it
+#endif
 
 // static variables track state of heap segment
 static void * segment_start = NULL;
 static size_t segment_size = 0;
+static size_t segment_reserve = 0;                          // size of current reservation
+static size_t configured_reserve = DEFAULT_SEGMENT_RESERVE; // size used by next init
+static unsigned segment_options = 0;                        // options of current segment
+static unsigned configured_options = 0;                     // options used by next init
+static bool reconfigured = false;    // reserve or options changed since last init
+
+// Extend commits ahead of demand: the segment is opened up (mprotect) in
+// steps that start at MIN_COMMIT_PAGES and double up to MAX_COMMIT_PAGES.
+// The committed-but-unused tail beyond segment_size is the wilderness that
+// later extends carve from by bumping segment_size, with no syscall.
+// With SEGMENT_HUGEPAGES every commit is a whole number of huge pages.
+#define MIN_COMMIT_PAGES 16     // 64 KB
+#define MAX_COMMIT_PAGES 1024   // 4 MB
+static size_t segment_committed = 0;   // bytes opened up, >= segment_size
+static size_t commit_step = MIN_COMMIT_PAGES*PAGE_SIZE;
+
+// number of memory-management syscalls (mmap, munmap, mprotect, mremap, madvise) made so far
+static size_t nsyscalls = 0;
+
+// With SEGMENT_PREFAULT_BACKGROUND a thread pre-faults committed pages up to
+// PREFAULT_DISTANCE bytes past the end of the segment. It works in
+// PREFAULT_STEP pieces, holding prefault_lock for each piece; while the
+// thread runs, the main thread holds the lock whenever it changes the
+// segment state the thread reads (start, committed, prefault offsets).
+#define PREFAULT_DISTANCE (1L << 22)       // 4 MB
+#define PREFAULT_STEP (64*PAGE_SIZE)       // 256 KB
+static pthread_mutex_t prefault_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefault_cond = PTHREAD_COND_INITIALIZER;
+static bool prefault_running = false;      // background thread started
+static size_t prefault_done = 0;           // segment offset populated so far by the thread
+static size_t prefault_target = 0;         // segment offset the thread should populate up to
+
+static void *init_segment(size_t npages);
+static void *extend_segment(size_t npages);
+
+// struct records one live chunk in the chunk table
+typedef struct {
+    void *base;     // CHUNK_SIZE-aligned start of the mapping
+    size_t size;    // bytes mapped, a multiple of CHUNK_SIZE
+} chunkT;
+
+// The chunk table is sorted by base address. It lives in its own mapping
+// (the allocator cannot be used to allocate its own bookkeeping) and doubles
+// in capacity with mremap when it fills up.
+static chunkT *chunk_table = NULL;
+static size_t nchunks = 0;
+static size_t chunk_capacity = 0;
 
 void *heap_segment_start()
 {
@@ -26,35 +81,381 @@ size_t heap_segment_size()
 }
 
 
+size_t heap_segment_reserve()
+{
+    return segment_reserve;
+}
+
+size_t heap_segment_syscalls()
+{
+    return nsyscalls;
+}
+
+unsigned heap_segment_options()
+{
+    return segment_options;
+}
+
+void set_heap_segment_options(unsigned options)
+{
+    configured_options = options;
+    reconfigured = true;
+}
+
+bool set_heap_segment_reserve(size_t nbytes)
+{
+    if (nbytes == 0 || nbytes > MAX_SEGMENT_RESERVE) return false;
+    configured_reserve = (nbytes + PAGE_SIZE-1) & ~((size_t)PAGE_SIZE-1);
+    reconfigured = true;
+    return true;
+}
+
+
+// Round sz up to a multiple of mult (mult must be a power of 2)
+static inline size_t segment_roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+// Granularity of commits, a huge page when the segment is backed by huge pages
+static inline size_t commit_unit(void)
+{
+    return (segment_options & SEGMENT_HUGEPAGES) ? HUGE_PAGE_SIZE : PAGE_SIZE;
+}
+
+// Fault in the pages of [start, start+nbytes) for writing without changing
+// their contents. Falls back to touching each page with an atomic add of 0
+// on kernels without MADV_POPULATE_WRITE.
+static void populate(void *start, size_t nbytes)
+{
+    if (madvise(start, nbytes, MADV_POPULATE_WRITE) == 0) return;
+    for (char *p = start; p < (char *)start + nbytes; p += PAGE_SIZE)
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+}
+
+// Body of the background pre-fault thread, see PREFAULT_DISTANCE
+static void *prefault_main(void *unused)
+{
+    pthread_mutex_lock(&prefault_lock);
+    while (true) {
+        while (segment_start == NULL || prefault_done >= prefault_target || prefault_done >= segment_committed)
+            pthread_cond_wait(&prefault_cond, &prefault_lock);
+        size_t end = prefault_done + PREFAULT_STEP;
+        if (end > prefault_target) end = prefault_target;
+        if (end > segment_committed) end = segment_committed;
+        populate((char *)segment_start + prefault_done, end - prefault_done);
+        prefault_done = end;
+        pthread_mutex_unlock(&prefault_lock);  // let extend in between steps
+        pthread_mutex_lock(&prefault_lock);
+    }
+    return NULL;
+}
+
+// Start the background pre-fault thread once, returns false if it cannot be started
+static bool start_prefault_thread(void)
+{
+    if (prefault_running) return true;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, prefault_main, NULL) != 0) return false;
+    pthread_detach(tid);
+    prefault_running = true;
+    return true;
+}
+
+// Move the background thread's target to PREFAULT_DISTANCE past the segment end
+static inline void update_prefault_target(void)
+{
+    prefault_target = segment_size + PREFAULT_DISTANCE;
+    pthread_cond_signal(&prefault_cond);
+}
+
+bool populate_heap_segment(void *start, size_t nbytes)
+{
+    char *first = (char *)((uintptr_t)start & ~((uintptr_t)PAGE_SIZE-1));
+    char *last = (char *)segment_roundup((uintptr_t)start + nbytes, PAGE_SIZE);
+    if (segment_start == NULL || first < (char *)segment_start || last > (char *)segment_start + segment_committed)
+        return false;  // outside the committed part of the segment
+    if (nbytes == 0) return true;
+    nsyscalls++;
+    populate(first, last - first);
+    return true;
+}
+
+bool purge_heap_segment(void *start, size_t nbytes)
+{
+    // discarding part of a huge page would split it, so only whole commit units go
+    char *first = (char *)segment_roundup((uintptr_t)start, commit_unit());
+    char *last = (char *)(((uintptr_t)start + nbytes) & ~((uintptr_t)commit_unit()-1));
+    if (segment_start == NULL || (char *)start < (char *)segment_start ||
+        (char *)start + nbytes > (char *)segment_start + segment_committed)
+        return false;  // outside the committed part of the segment
+    if (last <= first) return true;
+    nsyscalls++;
+    return madvise(first, last - first, MADV_DONTNEED) == 0;
+}
+
+// Reserve size bytes of address space aligned to align, by over-reserving
+// and trimming the misaligned head and unused tail. Returns NULL on failure.
+static void *reserve_aligned(size_t size, size_t align)
+{
+    nsyscalls++;
+    char *raw = mmap(0, size + align - PAGE_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    char *base = (char *)segment_roundup((uintptr_t)raw, align);
+    size_t head = base - raw, tail = (align - PAGE_SIZE) - head;
+    if (head != 0) { nsyscalls++; munmap(raw, head); }
+    if (tail != 0) { nsyscalls++; munmap(base + size, tail); }
+    return base;
+}
+
+
 // Discard any previous segment by unmapping old segment
-// Re-initialize by reserving new segment with mmap
+// Re-initialize by reserving new segment with mmap. The reservation is
+// MAP_NORESERVE so that a huge reservation is not charged against the
+// commit limit; only the pages opened up by extend count. With
+// SEGMENT_HUGEPAGES the reservation is aligned to HUGE_PAGE_SIZE and
+// marked MADV_HUGEPAGE so the kernel backs it with transparent huge pages.
 void *init_heap_segment(size_t npages)
+{
+    if (prefault_running) pthread_mutex_lock(&prefault_lock);
+    void *base = init_segment(npages);
+    if (prefault_running) pthread_mutex_unlock(&prefault_lock);
+    if ((segment_options & SEGMENT_PREFAULT_BACKGROUND) && !start_prefault_thread())
+        segment_options = (segment_options & ~SEGMENT_PREFAULT_BACKGROUND) | SEGMENT_PREFAULT;
+    return base;
+}
+
+// Body of init_heap_segment, called with prefault_lock held if the
+// background thread is running
+static void *init_segment(size_t npages)
 {
     if (segment_start != NULL) { // discard existing segment
-        if (munmap(segment_start, MAX_SEGMENT_SIZE) == -1) return NULL;
+        nsyscalls++;
+        if (munmap(segment_start, segment_reserve) == -1) return NULL;
         segment_start = NULL;
     }
+    segment_options = configured_options;
+    reconfigured = false;
+    size_t reserve = segment_roundup(configured_reserve, commit_unit());
     // reserve entire segment in advance
-    if ((segment_start = mmap(0, MAX_SEGMENT_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    if ((segment_start = reserve_aligned(reserve, commit_unit())) == NULL)
         return NULL; // allocation failure
+    if (segment_options & SEGMENT_HUGEPAGES) {
+        nsyscalls++;
+        madvise(segment_start, reserve, MADV_HUGEPAGE);  // advisory, THP may be disabled system-wide
+    }
+    segment_reserve = reserve;
+    segment_size = segment_committed = 0;
+    prefault_done = prefault_target = 0;
+    commit_step = segment_roundup(MIN_COMMIT_PAGES*PAGE_SIZE, commit_unit());
+    return extend_segment(npages);
+}
+
+
+// Keep the reservation and the committed range, but discard the contents
+// of the committed pages (they read back as zero) and empty the segment.
+// Falls back to init_heap_segment if there is no segment yet or the
+// configuration has changed since it was made.
+void *reset_heap_segment(void)
+{
+    if (segment_start == NULL || reconfigured) return init_heap_segment(0);
+    if (prefault_running) pthread_mutex_lock(&prefault_lock);
+    void *base = segment_start;
+    if (segment_committed > 0) {
+        nsyscalls++;
+        if (madvise(segment_start, segment_committed, MADV_DONTNEED) == -1) base = NULL;
+    }
     segment_size = 0;
-    return extend_heap_segment(npages);
+    prefault_done = prefault_target = 0;
+    if (segment_options & SEGMENT_PREFAULT_BACKGROUND)
+        update_prefault_target();
+    else if ((segment_options & SEGMENT_PREFAULT) && segment_committed > 0) {
+        nsyscalls++;
+        populate(segment_start, segment_committed);
+    }
+    if (prefault_running) pthread_mutex_unlock(&prefault_lock);
+    return base;
+}
+
+
+// Open up at least needed more bytes past the committed end. Commits a whole
+// commit_step if that is larger (clipped to the reservation), then doubles
+// the step for next time up to the cap.
+static bool commit_ahead(size_t needed)
+{
+    size_t increment_size = segment_roundup(needed > commit_step ? needed : commit_step, commit_unit());
+    if (segment_committed + increment_size > segment_reserve) {
+        if (needed > segment_reserve - segment_committed)
+            return false;  // cannot extend beyond reservation
+        increment_size = segment_reserve - segment_committed;
+    }
+    nsyscalls++;
+    if (mprotect((char *)segment_start + segment_committed, increment_size, PROT_READ|PROT_WRITE) == -1)
+        return false;  // allocation failure
+    if ((segment_options & (SEGMENT_PREFAULT|SEGMENT_PREFAULT_BACKGROUND)) == SEGMENT_PREFAULT) {
+        nsyscalls++;
+        populate((char *)segment_start + segment_committed, increment_size);
+    }
+    segment_committed += increment_size;
+    if (commit_step < MAX_COMMIT_PAGES*PAGE_SIZE) commit_step *= 2;
+    return true;
 }
 
 
-// Extend the segment and return the start address of new pages
+// Extend the segment and return the start address of new pages. Pages come
+// from the committed wilderness when it is big enough, otherwise more is
+// committed first.
 void *extend_heap_segment(size_t npages)
+{
+    if (!(segment_options & SEGMENT_PREFAULT_BACKGROUND)) return extend_segment(npages);
+    pthread_mutex_lock(&prefault_lock);
+    void *previous_end = extend_segment(npages);
+    pthread_mutex_unlock(&prefault_lock);
+    return previous_end;
+}
+
+// Body of extend_heap_segment, called with prefault_lock held in background
+// pre-fault mode. That mode also keeps PREFAULT_DISTANCE committed past the
+// end of the segment, so the thread has pages to work ahead on.
+static void *extend_segment(size_t npages)
 {
     if (segment_start == NULL) return NULL; // init has not been called?
 
     void *previous_end = (char *)segment_start + segment_size;
     if (npages <= 0) return previous_end;
+    if (npages > MAX_SEGMENT_RESERVE/PAGE_SIZE) return NULL;
     size_t increment_size = npages*PAGE_SIZE;
-    if (increment_size > MAX_SEGMENT_SIZE || (segment_size + increment_size) > MAX_SEGMENT_SIZE)
-        return NULL;  // cannot extend beyond max size
+    size_t wanted = segment_size + increment_size;
+    if (segment_options & SEGMENT_PREFAULT_BACKGROUND) wanted += PREFAULT_DISTANCE;
+    if (wanted > segment_committed && !commit_ahead(wanted - segment_committed) &&
+        segment_size + increment_size > segment_committed &&
+        !commit_ahead(segment_size + increment_size - segment_committed))
+        return NULL;
     segment_size += increment_size;
-    if (mprotect(previous_end, increment_size, PROT_READ|PROT_WRITE) == -1)
-        return NULL;  // allocation failure
+    if (segment_options & SEGMENT_PREFAULT_BACKGROUND) update_prefault_target();
     return previous_end;
 }
 
+
+
+// Returns index of the first chunk whose base is > ptr (binary search)
+static size_t chunk_upper_bound(const void *ptr)
+{
+    size_t lo = 0, hi = nchunks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if ((uintptr_t)chunk_table[mid].base <= (uintptr_t)ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Returns index of the chunk with exactly this base, or nchunks if none
+static size_t chunk_find(const void *chunk)
+{
+    size_t i = chunk_upper_bound(chunk);
+    if (i > 0 && chunk_table[i-1].base == chunk) return i-1;
+    return nchunks;
+}
+
+// Make room for one more entry in the chunk table, growing it if full
+static bool chunk_table_reserve(void)
+{
+    if (nchunks < chunk_capacity) return true;
+    size_t newcap = chunk_capacity ? chunk_capacity*2 : PAGE_SIZE/sizeof(chunkT);
+    void *table;
+    nsyscalls++;
+    if (chunk_table == NULL)
+        table = mmap(0, newcap*sizeof(chunkT), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    else
+        table = mremap(chunk_table, chunk_capacity*sizeof(chunkT), newcap*sizeof(chunkT), MREMAP_MAYMOVE);
+    if (table == MAP_FAILED) return false;
+    chunk_table = table;
+    chunk_capacity = newcap;
+    return true;
+}
+
+
+// Map an aligned chunk by over-reserving one extra CHUNK_SIZE and trimming
+// the misaligned head and the unused tail
+void *chunk_alloc(size_t nbytes)
+{
+    if (nbytes == 0 || nbytes > SIZE_MAX - 2*CHUNK_SIZE) return NULL;
+    size_t size = segment_roundup(nbytes, CHUNK_SIZE);
+    if (!chunk_table_reserve()) return NULL;
+
+    nsyscalls++;
+    char *raw = mmap(0, size + CHUNK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    char *base = (char *)segment_roundup((uintptr_t)raw, CHUNK_SIZE);
+    size_t head = base - raw, tail = CHUNK_SIZE - head;
+    if (head != 0) { nsyscalls++; munmap(raw, head); }
+    if (tail != 0) { nsyscalls++; munmap(base + size, tail); }
+    if (segment_options & SEGMENT_HUGEPAGES) {  // keep releasable chunks out of huge pages
+        nsyscalls++;
+        madvise(base, size, MADV_NOHUGEPAGE);
+    }
+
+    // insert into table keeping it sorted by address
+    size_t i = chunk_upper_bound(base);
+    memmove(&chunk_table[i+1], &chunk_table[i], (nchunks - i)*sizeof(chunkT));
+    chunk_table[i] = (chunkT){.base = base, .size = size};
+    nchunks++;
+    return base;
+}
+
+
+// Unmap a chunk and remove its entry from the table
+bool chunk_release(void *chunk)
+{
+    size_t i = chunk_find(chunk);
+    if (i == nchunks) return false;  // not a live chunk
+    nsyscalls++;
+    if (munmap(chunk_table[i].base, chunk_table[i].size) == -1) return false;
+    memmove(&chunk_table[i], &chunk_table[i+1], (nchunks - i - 1)*sizeof(chunkT));
+    nchunks--;
+    return true;
+}
+
+
+// Unmap the whole units past nbytes, then discard the pages past nbytes in what is left
+bool chunk_shrink(void *chunk, size_t nbytes)
+{
+    size_t i = chunk_find(chunk);
+    if (i == nchunks || nbytes == 0 || nbytes > chunk_table[i].size) return false;
+    char *base = chunk_table[i].base;
+    size_t keep = segment_roundup(nbytes, CHUNK_SIZE);
+    if (keep < chunk_table[i].size) {
+        nsyscalls++;
+        if (munmap(base + keep, chunk_table[i].size - keep) == -1) return false;
+        chunk_table[i].size = keep;
+    }
+    char *first = (char *)segment_roundup((uintptr_t)base + nbytes, PAGE_SIZE);
+    if (first == base + keep) return true;
+    nsyscalls++;
+    return madvise(first, base + keep - first, MADV_DONTNEED) == 0;
+}
+
+
+void *chunk_lookup(const void *ptr)
+{
+    size_t i = chunk_upper_bound(ptr);
+    if (i == 0) return NULL;
+    chunkT *c = &chunk_table[i-1];
+    return ((uintptr_t)ptr - (uintptr_t)c->base < c->size) ? c->base : NULL;
+}
+
+
+size_t chunk_size(const void *chunk)
+{
+    size_t i = chunk_find(chunk);
+    return i == nchunks ? 0 : chunk_table[i].size;
+}
+
+
+size_t chunk_count(void)
+{
+    return nchunks;
+}
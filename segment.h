@@ -4,13 +4,16 @@
  * allocate/extend a large segment of memory. Your allocator will call these
  * functions to manage the segment which is parceled out in response to
  * malloc requests. The segment is allocated in page-size chunks.
- * There is an upper bound on the total segment size. If you attempt to extend
- * the segment beyond that bound, NULL is returned to indicate failure.
+ * The segment lives inside an address-space reservation (256 GB by default,
+ * configurable with set_heap_segment_reserve). The reservation costs no
+ * memory until pages are opened up, so it is made large up front and never
+ * grows: extending past it returns NULL to indicate failure.
  */
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
-#include <stddef.h> // for size_t
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
 
 /* Constants
  * ---------
@@ -20,6 +23,25 @@
  */
 #define PAGE_SIZE 4096
 
+/* HUGE_PAGE_SIZE is the size of a transparent huge page on x86-64. When the
+ * segment is backed by huge pages, its reservation is aligned to this size
+ * and it is committed in whole huge pages.
+ */
+#define HUGE_PAGE_SIZE (1L << 21)   // 2 MB
+
+/* CHUNK_SIZE is the granularity of the chunk layer below. Every chunk is
+ * a whole number of CHUNK_SIZE units and its base address is aligned to
+ * CHUNK_SIZE. It must be a power of 2 and a multiple of PAGE_SIZE.
+ */
+#define CHUNK_SIZE (1L << 22)   // 4 MB
+
+/* DEFAULT_SEGMENT_RESERVE is the address space reserved for the heap segment
+ * unless configured otherwise. MAX_SEGMENT_RESERVE bounds how large a
+ * reservation may be configured.
+ */
+#define DEFAULT_SEGMENT_RESERVE (1L << 38)   // 256 GB
+#define MAX_SEGMENT_RESERVE (1L << 40)       // 1 TB
+
 
 /* Function: init_heap_segment
  * ---------------------------
@@ -36,6 +58,22 @@ void *init_heap_segment(size_t npages);
 
 
 
+/* Function: reset_heap_segment
+ * ----------------------------
+ * A cheap alternative to calling init_heap_segment again. It empties the
+ * segment but keeps the address-space reservation and the pages committed
+ * so far. Their contents are discarded with madvise, so they read back as
+ * zero, and they are handed out again by later calls to extend without
+ * further syscalls. The cost is one madvise call plus page faults on reuse,
+ * instead of an munmap/mmap pair and a fresh run of mprotect calls. If there
+ * is no segment yet, or the reserve size or options have been changed, it
+ * calls init_heap_segment(0) instead. Returns the base address of the segment,
+ * or NULL on failure.
+ */
+void *reset_heap_segment(void);
+
+
+
 /* Function: extend_heap_segment
  * -----------------------------
  * This function is called to extend the size of the existing heap segment. The
@@ -60,4 +98,137 @@ void *heap_segment_start(void);
 size_t heap_segment_size(void);
 
 
+/* Functions: set_heap_segment_reserve, heap_segment_reserve
+ * ---------------------------------------------------------
+ * set_heap_segment_reserve configures the size in bytes of the address-space
+ * reservation made by the next call to init_heap_segment. The value is rounded
+ * up to a multiple of PAGE_SIZE. Returns false (and changes nothing) if nbytes
+ * is 0 or exceeds MAX_SEGMENT_RESERVE. heap_segment_reserve returns the size
+ * of the current reservation (the configured size rounded up to a whole
+ * number of commit units).
+ */
+bool set_heap_segment_reserve(size_t nbytes);
+size_t heap_segment_reserve(void);
+
+
+/* Functions: set_heap_segment_options, heap_segment_options
+ * ---------------------------------------------------------
+ * set_heap_segment_options configures options for the segment made by the next
+ * call to init_heap_segment, as a combination of the SEGMENT_ flags below.
+ * heap_segment_options returns the options of the current segment.
+ *
+ * SEGMENT_HUGEPAGES aligns the reservation to HUGE_PAGE_SIZE, asks the kernel
+ * to back it with transparent huge pages (MADV_HUGEPAGE) and commits it in
+ * huge-page units. The heap segment holds the allocator's small, hot
+ * objects. Chunks mapped while the current segment has this option are kept
+ * out of huge pages (MADV_NOHUGEPAGE): they are released one at a time, and
+ * that avoids splitting huge pages when their memory is returned to the OS.
+ *
+ * SEGMENT_PREFAULT pre-faults each newly committed range (MADV_POPULATE_WRITE)
+ * so the first touch of a page handed out by extend does not take a page fault.
+ * SEGMENT_PREFAULT_BACKGROUND moves that work to a background thread that keeps
+ * the pages a fixed distance (a few MB) past the end of the segment faulted in.
+ * If the thread cannot be started, it falls back to SEGMENT_PREFAULT.
+ */
+#define SEGMENT_HUGEPAGES 0x1
+#define SEGMENT_PREFAULT 0x2
+#define SEGMENT_PREFAULT_BACKGROUND 0x4
+
+void set_heap_segment_options(unsigned options);
+unsigned heap_segment_options(void);
+
+
+/* Function: populate_heap_segment
+ * -------------------------------
+ * Pre-faults the pages overlapping [start, start+nbytes) so that later
+ * accesses do not take page faults. Page contents are left unchanged. The range
+ * must lie within the pages opened up for the segment. Returns false if it
+ * does not.
+ */
+bool populate_heap_segment(void *start, size_t nbytes);
+
+
+/* Function: purge_heap_segment
+ * ----------------------------
+ * Discards the contents of the whole pages within [start, start+nbytes)
+ * (madvise MADV_DONTNEED). The pages stay committed and read back as zero,
+ * faulting in fresh on next touch. Partial pages at either end are left
+ * alone; with SEGMENT_HUGEPAGES the unit is a whole huge page, so that no
+ * huge page is split. The range must lie within the pages opened up for the
+ * segment.
+ * Returns false if it does not or the discard failed.
+ */
+bool purge_heap_segment(void *start, size_t nbytes);
+
+
+/* Function: heap_segment_syscalls
+ * -------------------------------
+ * Returns the number of memory-management system calls (mmap, munmap,
+ * mprotect, mremap, madvise) the segment and chunk layers have made since the
+ * program started, not counting the background pre-fault thread. To keep
+ * this count low, extend_heap_segment commits pages ahead of demand in
+ * geometrically growing steps (capped at a few MB). Pages that are committed
+ * but not yet handed out are not counted in heap_segment_size.
+ */
+size_t heap_segment_syscalls(void);
+
+
+/* Chunk layer
+ * -----------
+ * Unlike the heap segment, which is one contiguous reservation that only
+ * grows, chunks are independent mappings that can be added and released
+ * one at a time. A heap built from chunks can return any one of them to the
+ * OS and is not bounded by the size of a single reservation. Chunks are
+ * separate from the heap segment above; init_heap_segment does not touch them.
+ */
+
+/* Function: chunk_alloc
+ * ---------------------
+ * Maps a new chunk large enough to hold nbytes, rounded up to a multiple of
+ * CHUNK_SIZE. The chunk is readable and writable, zero-filled, and its base
+ * address is aligned to CHUNK_SIZE. Returns the base address of the chunk,
+ * or NULL if nbytes is 0 or the mapping failed.
+ */
+void *chunk_alloc(size_t nbytes);
+
+
+/* Function: chunk_release
+ * -----------------------
+ * Unmaps a chunk previously returned by chunk_alloc and forgets it. The
+ * argument must be the base address of a live chunk. Returns true on
+ * success, false if chunk is not a live chunk or the unmap failed.
+ */
+bool chunk_release(void *chunk);
+
+
+/* Function: chunk_shrink
+ * ----------------------
+ * Shrinks a live chunk so it keeps only its first nbytes. Whole CHUNK_SIZE
+ * units past nbytes are unmapped and the chunk's size drops accordingly; the
+ * whole pages past nbytes in the last unit are discarded (madvise
+ * MADV_DONTNEED) and read back as zero. Returns false if chunk is not a live
+ * chunk, nbytes is 0 or larger than the chunk, or the unmap/discard failed.
+ */
+bool chunk_shrink(void *chunk, size_t nbytes);
+
+
+/* Function: chunk_lookup
+ * ----------------------
+ * Returns the base address of the live chunk that contains ptr, or NULL if
+ * ptr does not lie within any chunk. Lookup is a binary search over the
+ * live chunks, which are kept sorted by address.
+ */
+void *chunk_lookup(const void *ptr);
+
+
+/* Functions: chunk_size, chunk_count
+ * ----------------------------------
+ * chunk_size returns the size in bytes of the live chunk with the given base
+ * address (0 if there is no such chunk). chunk_count returns the number of
+ * live chunks.
+ */
+size_t chunk_size(const void *chunk);
+size_t chunk_count(void);
+
+
 #endif
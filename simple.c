@@ -8,6 +8,9 @@
 #include <string.h>
 #include "allocator.h"
 
+// Objects of a group start on this boundary, as promised by mymalloc_group
+#define ALIGNMENT HEAP_ALIGNMENT
+
 
 typedef struct _cell {
    char *string;
@@ -15,17 +18,34 @@ typedef struct _cell {
 } cell;
     
 	
+// Round sz up to a multiple of mult (mult must be a power of 2)
+static inline size_t roundup(size_t sz, size_t mult)
+{
+   return (sz + mult-1) & ~(mult-1);
+}
+
 // Add a new cell to front of list, data for new cell is
 // string s. head is passed by ref to change to point to new cell
+// The cell and its string are allocated together, string right after the cell
 static void push(cell **head, char *s)
 {
-   cell *c = (cell *)mymalloc(sizeof(cell));
+   size_t sizes[2] = {sizeof(cell), strlen(s)+1};
+   void *objs[2];
+   cell *c = (cell *)mymalloc_group(sizes, 2, objs);
    c->next = *head;
-   c->string = mymalloc(strlen(s)+1);
+   c->string = objs[1];
    strcpy(c->string, s);
    *head = c;
 }
 
+// A cell's string is a block of its own once it has outgrown the one
+// allocated together with the cell, which starts at the first ALIGNMENT
+// boundary past the cell
+static bool owns_string(cell *c)
+{
+   return c->string != (char *)c + roundup(sizeof(cell), ALIGNMENT);
+}
+
 // Print entire linked list
 static void print_list(cell *head)
 {
@@ -40,7 +60,7 @@ static void free_list(cell *head)
 {
    while (head != NULL) {
       cell *next = head->next;
-      myfree(head->string);
+      if (owns_string(head)) myfree(head->string);
       myfree(head);
       head = next;
    }
@@ -54,11 +74,15 @@ static void concat_neighbors(cell *head)
    for (cell *cur = head; cur && cur->next != NULL; cur=cur->next) {
       cell *next = cur->next;
       cur->next = next->next;
-      cur->string = myrealloc(cur->string, strlen(cur->string)+strlen(next->string)+2);
+      size_t newsz = strlen(cur->string)+strlen(next->string)+2;
+      if (owns_string(cur))
+         cur->string = myrealloc(cur->string, newsz);
+      else
+         cur->string = strcpy(mymalloc(newsz), cur->string);
       int len = strlen(cur->string);
       cur->string[len] = '-';
       strcpy(cur->string+len+1, next->string);
-      myfree(next->string);
+      if (owns_string(next)) myfree(next->string);
       myfree(next);
    }
 }
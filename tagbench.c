@@ -0,0 +1,121 @@
+/*
+ * File: tagbench.c
+ * ----------------
+ * Pointer-chasing benchmark for tagged allocation. Builds a linked list of
+ * cells and strings (as in simple.c) on a heap that is already fragmented,
+ * with unrelated allocations interleaved between the nodes, then times
+ * traversals of the list. The list is built twice, once with mymalloc and
+ * once with mymalloc_tagged, and the cycles per node visited are compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "fcyc.h"
+
+#define LIST_TAG 1
+#define NTRAVERSALS 10
+
+typedef struct _cell {
+   char *string;
+   struct _cell *next;
+} cell;
+
+static int nnodes = 20000;           // list length (-n)
+static int nnoise = 2;               // unrelated allocations between two nodes (-i)
+
+static void usage(void);
+
+// Allocates a node block, tagged or not
+static void *node_alloc(size_t size, bool tagged)
+{
+    return tagged ? mymalloc_tagged(size, LIST_TAG) : mymalloc(size);
+}
+
+// Fragments the heap: allocates blocks of random size and frees every other one
+static void fragment_heap(int nblocks)
+{
+    void **blocks = malloc(nblocks * sizeof(void *));
+    for (int i = 0; i < nblocks; i++)
+        blocks[i] = mymalloc(16 + rand() % 241);
+    for (int i = 0; i < nblocks; i += 2)
+        myfree(blocks[i]);
+    free(blocks);
+}
+
+// Builds the list, pushing cells to the front, with nnoise unrelated blocks allocated around each node
+static cell *build_list(bool tagged)
+{
+    cell *head = NULL;
+    char buf[32];
+    for (int i = 0; i < nnodes; i++) {
+        cell *c = node_alloc(sizeof(cell), tagged);
+        sprintf(buf, "node-%d", i);
+        c->string = node_alloc(strlen(buf)+1, tagged);
+        strcpy(c->string, buf);
+        c->next = head;
+        head = c;
+        for (int k = 0; k < nnoise; k++)
+            mymalloc(16 + rand() % 241);   // never freed, keeps the nodes apart
+    }
+    return head;
+}
+
+// Walks the list, touching every cell and its string, returns the cycles per node
+static double traverse(cell *head)
+{
+    size_t total = 0;
+    start_counter();
+    for (int t = 0; t < NTRAVERSALS; t++)
+        for (cell *cur = head; cur != NULL; cur = cur->next)
+            total += strlen(cur->string);
+    double cycles = get_counter();
+    if (total == 0) printf("empty list\n");   // keeps the walk from being optimized away
+    return cycles / NTRAVERSALS / nnodes;
+}
+
+static double run(bool tagged)
+{
+    myinit();
+    srand(107);
+    fragment_heap(2*nnodes);
+    cell *head = build_list(tagged);
+    return traverse(head);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:i:")) != EOF) {
+        switch (c) {
+            case 'n':
+                nnodes = atoi(optarg);
+                break;
+            case 'i':
+                nnoise = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || nnodes <= 0 || nnoise < 0) usage();
+
+    double untagged = run(false);
+    double tagged = run(true);
+    printf("list of %d nodes, %d unrelated allocations per node, %d traversals\n", nnodes, nnoise, NTRAVERSALS);
+    printf("%-22s %16s\n", "allocation", "cycles/node");
+    printf("%-22s %16.1f\n", "mymalloc", untagged);
+    printf("%-22s %16.1f\n", "mymalloc_tagged", tagged);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tagbench [-n <nodes>] [-i <allocations>]\n");
+    fprintf(stderr, "\t-n <nodes>        Length of the list (default 20000).\n");
+    fprintf(stderr, "\t-i <allocations>  Unrelated allocations between two nodes (default 2).\n");
+    exit(107);
+}